@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cassert>
+
+#include "adaptive_aoi/adaptive_aoi.h"
+#include "crosslink_aoi/crosslink_aoi.h"
+#include "quadtree_aoi/quadtree_aoi.h"
+#include "tower_aoi/tower_aoi.h"
+
+AdaptiveAOI::AdaptiveAOI(float width, float height, float visible_range,
+                         const AOI::Callback& enter_callback,
+                         const AOI::Callback& leave_callback,
+                         const Options& options)
+    : width_(width),
+      height_(height),
+      visible_range_(visible_range),
+      enter_callback_(enter_callback),
+      leave_callback_(leave_callback),
+      options_(options),
+      pair_event_(false),
+      large_range_(0),
+      defer_updates_(false),
+      in_tick_(false),
+      models_{nullptr, nullptr},
+      kinds_{options.model, options.model},
+      active_(0),
+      target_units_(0),
+      steps_(0),
+      moves_(0),
+      move_rate_(0),
+      crowding_(0),
+      votes_(0),
+      migrations_(0) {
+  models_[active_] = NewModel(options.model, active_);
+}
+
+AdaptiveAOI::~AdaptiveAOI() {
+  delete models_[0];
+  delete models_[1];
+}
+
+AOI* AdaptiveAOI::NewModel(Model model, int slot) {
+  // Events of the model being migrated to are dropped until it takes over
+  auto enter_callback = [this, slot](int id, int other_id) {
+    if (slot == active_) {
+      enter_callback_(id, other_id);
+    }
+  };
+  auto leave_callback = [this, slot](int id, int other_id) {
+    if (slot == active_) {
+      leave_callback_(id, other_id);
+    }
+  };
+
+  AOI* aoi = nullptr;
+  switch (model) {
+    case kTower:
+      aoi = new TowerAOI(width_, height_, visible_range_, enter_callback,
+                         leave_callback);
+      break;
+    case kQuadTree:
+      aoi = new QuadTreeAOI(width_, height_, visible_range_, enter_callback,
+                            leave_callback);
+      break;
+    case kCrosslink:
+      aoi = new CrosslinkAOI(width_, height_, visible_range_, enter_callback,
+                             leave_callback);
+      break;
+  }
+  aoi->SetPairEvent(pair_event_);
+  if (nullptr != tier_callback_) {
+    aoi->SetRangeTiers(tier_bounds_, [this, slot](int id, int other_id,
+                                                  int tier) {
+      if (slot == active_) {
+        tier_callback_(id, other_id, tier);
+      }
+    });
+  }
+  if (large_range_ > 0) {
+    aoi->SetLargeRange(large_range_);
+  }
+  aoi->SetDeferUpdates(defer_updates_);
+  return aoi;
+}
+
+void AdaptiveAOI::AddUnit(AOI::UnitID id, float x, float y, int flags,
+                          float range, uint32_t mask, int layer) {
+  models_[active_]->AddUnit(id, x, y, flags, range, mask, layer);
+  Entry entry{AOI::BulkUnit(id, x, y, flags, range, mask, layer),
+              migrating()};
+  units_.insert(std::pair(id, entry));
+  if (entry.migrated) {
+    models_[1 - active_]->AddUnit(id, x, y, flags, range, mask, layer);
+    ++target_units_;
+  }
+  ++layer_counts_[layer];
+}
+
+void AdaptiveAOI::UpdateUnit(AOI::UnitID id, float x, float y) {
+  models_[active_]->UpdateUnit(id, x, y);
+  Entry& entry = units_.at(id);
+  entry.unit.x = x;
+  entry.unit.y = y;
+  if (migrating() && entry.migrated) {
+    models_[1 - active_]->UpdateUnit(id, x, y);
+  }
+  ++moves_;
+}
+
+void AdaptiveAOI::RemoveUnit(AOI::UnitID id) {
+  models_[active_]->RemoveUnit(id);
+  auto it = units_.find(id);
+  if (migrating() && it->second.migrated) {
+    models_[1 - active_]->RemoveUnit(id);
+    --target_units_;
+  }
+  auto layer_it = layer_counts_.find(it->second.unit.layer);
+  if (0 == --layer_it->second) {
+    layer_counts_.erase(layer_it);
+  }
+  units_.erase(it);
+}
+
+void AdaptiveAOI::SetPairEvent(bool pair_event) {
+  assert(units_.empty() && !migrating());
+  pair_event_ = pair_event;
+  models_[active_]->SetPairEvent(pair_event);
+}
+
+void AdaptiveAOI::SetRangeTiers(const std::vector<float>& bounds,
+                                const AOI::TierCallback& tier_callback) {
+  assert(units_.empty() && !migrating());
+  tier_bounds_ = bounds;
+  tier_callback_ = tier_callback;
+  models_[active_]->SetRangeTiers(bounds, tier_callback);
+}
+
+void AdaptiveAOI::SetLargeRange(float range) {
+  assert(units_.empty() && !migrating());
+  large_range_ = range;
+  models_[active_]->SetLargeRange(range);
+}
+
+void AdaptiveAOI::SetDeferUpdates(bool defer_updates) {
+  defer_updates_ = defer_updates;
+  models_[active_]->SetDeferUpdates(defer_updates);
+  if (migrating()) {
+    models_[1 - active_]->SetDeferUpdates(defer_updates);
+  }
+}
+
+size_t AdaptiveAOI::ProcessUpdates(const AOI::UpdateBudget& budget) {
+  if (!migrating()) {
+    return models_[active_]->ProcessUpdates(budget);
+  }
+  // Callbacks of the model in use may move units again, which the target
+  // model defers until it processes them after
+  size_t moved = models_[active_]->ProcessUpdates(AOI::UpdateBudget());
+  models_[1 - active_]->ProcessUpdates(AOI::UpdateBudget());
+  return moved;
+}
+
+void AdaptiveAOI::BeginTick() {
+  in_tick_ = true;
+  models_[active_]->BeginTick();
+}
+
+void AdaptiveAOI::EndTick() {
+  in_tick_ = false;
+  models_[active_]->EndTick();
+}
+
+void AdaptiveAOI::Step() {
+  assert(!in_tick_);
+  ++steps_;
+  float rate = units_.empty() ? 0 : float(moves_) / units_.size();
+  move_rate_ = 1 == steps_ ? rate : move_rate_ * 0.8f + rate * 0.2f;
+  moves_ = 0;
+
+  if (migrating()) {
+    MigrateBatch();
+    return;
+  }
+  if (steps_ % options_.sample_interval != 0) {
+    return;
+  }
+
+  SampleCrowding();
+  Model preferred = model();
+  if (crowding_ > options_.crowded) {
+    preferred = kQuadTree;
+  } else if (crowding_ < options_.sparse) {
+    preferred = kTower;
+  }
+  if (preferred == model() || move_rate_ < options_.min_move_rate) {
+    votes_ = 0;
+    return;
+  }
+  if (++votes_ >= options_.patience) {
+    votes_ = 0;
+    Migrate(preferred);
+  }
+}
+
+void AdaptiveAOI::Migrate(Model model) {
+  if (model == kinds_[active_] || migrating()) {
+    return;
+  }
+
+  int target = 1 - active_;
+  models_[target] = NewModel(model, target);
+  kinds_[target] = model;
+  target_units_ = 0;
+  pending_ids_.clear();
+  pending_ids_.reserve(units_.size());
+  for (auto& pair : units_) {
+    pair.second.migrated = false;
+    pending_ids_.push_back(pair.first);
+  }
+}
+
+void AdaptiveAOI::MigrateBatch() {
+  // Units are copied at their last positions, which deferred moves have not
+  // reached yet
+  if (defer_updates_) {
+    ProcessUpdates(AOI::UpdateBudget());
+  }
+
+  std::vector<AOI::BulkUnit> batch;
+  batch.reserve(std::min(options_.migrate_batch, pending_ids_.size()));
+  while (!pending_ids_.empty() && batch.size() < options_.migrate_batch) {
+    auto it = units_.find(pending_ids_.back());
+    pending_ids_.pop_back();
+    // Skip units removed since, or added again and so already copied
+    if (it != units_.end() && !it->second.migrated) {
+      it->second.migrated = true;
+      batch.push_back(it->second.unit);
+    }
+  }
+
+  // The first batch builds the index at once, the next ones are added with
+  // their relations to the units already copied
+  AOI* target = models_[1 - active_];
+  if (0 == target_units_) {
+    target->BulkLoad(batch, false);
+  } else {
+    for (const auto& unit : batch) {
+      target->AddUnit(unit.id, unit.x, unit.y, unit.flags, unit.range,
+                      unit.mask, unit.layer);
+    }
+  }
+  target_units_ += batch.size();
+
+  if (pending_ids_.empty()) {
+    // Relations only depend on the units and their positions, so the new
+    // model already holds the same relations as the old one
+    delete models_[active_];
+    models_[active_] = nullptr;
+    active_ = 1 - active_;
+    ++migrations_;
+  }
+}
+
+void AdaptiveAOI::SampleCrowding() {
+  // Mean over units of the units in their cell, cells being as large as the
+  // visible range
+  uint64_t sum = 0;
+  uint64_t square_sum = 0;
+  for (const auto& pair : layer_counts_) {
+    for (uint32_t count : aoi().DensityGrid(visible_range_, pair.first)) {
+      sum += count;
+      square_sum += static_cast<uint64_t>(count) * count;
+    }
+  }
+  crowding_ = sum > 0 ? float(square_sum) / sum : 0;
+}
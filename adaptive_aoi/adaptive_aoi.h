@@ -0,0 +1,161 @@
+#ifndef ADAPTIVE_AOI_H
+#define ADAPTIVE_AOI_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "aoi.h"
+
+// AOI which moves its units to another model as the population changes.
+// Every Step samples how crowded units are and how many of them move, and
+// when another model is preferred for long enough, the units are copied into
+// it a batch per step while both models are kept up to date. The new model
+// then takes over with the same subscriptions, the copy fires no event.
+//
+// TowerAOI is preferred on sparse maps and QuadTreeAOI when units crowd
+// around a few places, CrosslinkAOI is only used through Migrate
+class AdaptiveAOI {
+ public:
+  enum Model { kTower, kQuadTree, kCrosslink };
+
+  struct Options {
+    Options()
+        : model(kTower),
+          crowded(48),
+          sparse(16),
+          min_move_rate(0.05f),
+          sample_interval(10),
+          patience(3),
+          migrate_batch(2000) {}
+
+    Model model;  // Initial model
+    // Crowding, the mean number of units sharing a visible range cell with
+    // a unit, above which QuadTreeAOI is preferred and below which TowerAOI
+    // is preferred again
+    float crowded;
+    float sparse;
+    // Fraction of units moved per step, below which the model is kept since
+    // the index costs little
+    float min_move_rate;
+    int sample_interval;   // Steps between two samples of crowding
+    int patience;          // Samples in a row preferring a model to migrate
+    size_t migrate_batch;  // Units copied per step
+  };
+
+  AdaptiveAOI(float width, float height, float visible_range,
+              const AOI::Callback& enter_callback,
+              const AOI::Callback& leave_callback,
+              const Options& options = Options());
+  ~AdaptiveAOI();
+
+  AdaptiveAOI(const AdaptiveAOI&) = delete;
+  AdaptiveAOI(AdaptiveAOI&&) = delete;
+  AdaptiveAOI& operator=(const AdaptiveAOI&) = delete;
+  AdaptiveAOI& operator=(AdaptiveAOI&&) = delete;
+
+  void AddUnit(AOI::UnitID id, float x, float y, int flags, float range,
+               uint32_t mask, int layer);
+  void AddUnit(AOI::UnitID id, float x, float y) {
+    AddUnit(id, x, y, AOI::kWatcher | AOI::kMarker, visible_range_,
+            AOI::kAllMask, 0);
+  }
+  void AddUnit(AOI::UnitID id, float x, float y, int flags, float range) {
+    AddUnit(id, x, y, flags, range, AOI::kAllMask, 0);
+  }
+  void UpdateUnit(AOI::UnitID id, float x, float y);
+  void RemoveUnit(AOI::UnitID id);
+
+  std::unordered_set<int> FindNearbyUnit(AOI::UnitID id, float range) const {
+    return aoi().FindNearbyUnit(id, range);
+  }
+  std::unordered_set<int> GetSubScribeSet(AOI::UnitID id) const {
+    return aoi().GetSubScribeSet(id);
+  }
+  int GetTier(AOI::UnitID id, AOI::UnitID other_id) const {
+    return aoi().GetTier(id, other_id);
+  }
+
+  // See AOI::SetPairEvent
+  void SetPairEvent(bool pair_event);
+
+  // See AOI::SetRangeTiers
+  void SetRangeTiers(const std::vector<float>& bounds,
+                     const AOI::TierCallback& tier_callback);
+
+  // See AOI::SetLargeRange
+  void SetLargeRange(float range);
+
+  // See AOI::SetDeferUpdates. While migrating, ProcessUpdates moves every
+  // deferred unit whatever the budget, so that both models keep the same
+  // positions, which each batch also does before copying units
+  void SetDeferUpdates(bool defer_updates);
+  size_t ProcessUpdates(const AOI::UpdateBudget& budget);
+  AOI::UpdateBacklog GetUpdateBacklog() const {
+    return aoi().GetUpdateBacklog();
+  }
+
+  void BeginTick();
+  void EndTick();
+
+  // Sample the statistics and copy a batch of units if migrating. Call it
+  // once per game tick, outside of BeginTick and EndTick
+  void Step();
+
+  // Start moving the units into the given model, no-op if it is already in
+  // use or during another migration
+  void Migrate(Model model);
+
+  // The model in use, which serves all queries
+  const AOI& aoi() const { return *models_[active_]; }
+  Model model() const { return kinds_[active_]; }
+  bool migrating() const { return nullptr != models_[1 - active_]; }
+  size_t migrations() const { return migrations_; }
+  float crowding() const { return crowding_; }
+  float move_rate() const { return move_rate_; }
+
+ private:
+  struct Entry {
+    AOI::BulkUnit unit;
+    bool migrated;  // Whether the unit is in the model being migrated to
+  };
+
+  AOI* NewModel(Model model, int slot);
+  void MigrateBatch();
+  void SampleCrowding();
+
+  float const width_;
+  float const height_;
+  float const visible_range_;
+  AOI::Callback const enter_callback_;
+  AOI::Callback const leave_callback_;
+  Options const options_;
+  bool pair_event_;
+  std::vector<float> tier_bounds_;
+  AOI::TierCallback tier_callback_;
+  float large_range_;  // 0 for the default of the models
+  bool defer_updates_;
+  bool in_tick_;
+
+  // The model in use and the one being migrated to, only the model in use
+  // forwards events
+  AOI* models_[2];
+  Model kinds_[2];
+  int active_;
+
+  std::unordered_map<AOI::UnitID, Entry> units_;
+  std::unordered_map<int, size_t> layer_counts_;  // Units of each layer
+
+  // Migration state
+  std::vector<AOI::UnitID> pending_ids_;  // Units left to copy
+  size_t target_units_;                   // Units in the target model
+
+  // Statistics
+  size_t steps_;
+  size_t moves_;  // Updates since the last step
+  float move_rate_;
+  float crowding_;
+  int votes_;  // Samples in a row preferring another model
+  size_t migrations_;
+};
+
+#endif  // ADAPTIVE_AOI_H
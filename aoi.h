@@ -1,46 +1,169 @@
 #ifndef AOI_H
 #define AOI_H
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include "aoi_shape.h"
+#include "aoi_stats.h"
 
 class AOI {
  public:
   struct Unit;
+  struct Edge;
 
   typedef int UnitID;
   typedef std::unordered_set<Unit*> UnitSet;
   typedef std::unordered_map<int, Unit*> UnitMap;
+  typedef std::unordered_map<Unit*, int> RelationMap;
+
+  // Role of a unit, a unit can be both
+  enum UnitFlag {
+    kWatcher = 1,  // Observes other units within its visible range
+    kMarker = 2,   // Can be observed by watchers
+  };
+
+  // Directions of the relation between a unit and another unit
+  enum RelationFlag {
+    kSubscribe = 1,  // The unit watches the other
+    kObserved = 2,   // The other watches the unit
+  };
+
+  static constexpr uint32_t kAllMask = 0xffffffff;
+
   struct Unit {
-    Unit(UnitID id_, float x_, float y_) : id(id_), x(x_), y(y_) {}
+    Unit(UnitID id_, float x_, float y_)
+        : id(id_),
+          x(x_),
+          y(y_),
+          flags(kWatcher | kMarker),
+          range(0),
+          mask(kAllMask),
+          layer(0),
+          edge_head(nullptr) {}
 
     ~Unit(){};
 
-    void Subscribe(const Unit* other) {
-      subscribe_set.insert(const_cast<Unit*>(other));
+    // Set the relation with other on both sides, the bits above the flags
+    // are the same on both sides
+    void Relate(Unit* other, int relation) {
+      relation_map[other] = relation;
+      other->relation_map[this] =
+          (relation & ~(kSubscribe | kObserved)) |
+          (relation & kSubscribe ? kObserved : 0) |
+          (relation & kObserved ? kSubscribe : 0);
     }
-    void UnSubscribe(const Unit* other) {
-      subscribe_set.erase(const_cast<Unit*>(other));
+
+    bool IsWatcher() const { return flags & kWatcher; }
+    bool IsMarker() const { return flags & kMarker; }
+
+    // Units in the same layer see each other only if their masks intersect
+    bool Matches(const Unit* other) const {
+      return layer == other->layer && 0 != (mask & other->mask);
     }
 
     UnitID id;
     float x;
     float y;
-    UnitSet subscribe_set;
+    int flags;
+    float range;               // Visible range, only meaningful for watchers
+    uint32_t mask;             // Visibility mask
+    int layer;                 // Units in other layers are never seen
+    RelationMap relation_map;  // Units related to this unit in any direction
+    Edge* edge_head;           // Pair relations in pair event mode
+  };
+
+  // A symmetric relation between two units in pair event mode, it is stored
+  // once and linked into the edge lists of both units
+  struct Edge {
+    Edge()
+        : units{nullptr, nullptr},
+          prevs{nullptr, nullptr},
+          nexts{nullptr, nullptr},
+          tier(0) {}
+
+    int Slot(const Unit* unit) const { return units[0] == unit ? 0 : 1; }
+    Unit* Other(const Unit* unit) const { return units[1 - Slot(unit)]; }
+    Edge* Next(const Unit* unit) const { return nexts[Slot(unit)]; }
+
+    Unit* units[2];
+    Edge* prevs[2];
+    Edge* nexts[2];
+    int tier;  // Range tier of the pair, see SetRangeTiers
+  };
+
+  // A unit found by a nearest neighbour query
+  struct Neighbor {
+    UnitID id;
+    float distance;  // Euclidean distance to the query point
+  };
+
+  // A unit to load by BulkLoad
+  struct BulkUnit {
+    BulkUnit(UnitID id_, float x_, float y_)
+        : BulkUnit(id_, x_, y_, kWatcher | kMarker, -1, kAllMask, 0) {}
+    BulkUnit(UnitID id_, float x_, float y_, int flags_, float range_,
+             uint32_t mask_, int layer_)
+        : id(id_),
+          x(x_),
+          y(y_),
+          flags(flags_),
+          range(range_),
+          mask(mask_),
+          layer(layer_) {}
+
+    UnitID id;
+    float x;
+    float y;
+    int flags;
+    float range;  // Negative for the default visible range
+    uint32_t mask;
+    int layer;
+  };
+
+  // Limits of one ProcessUpdates call
+  struct UpdateBudget {
+    UpdateBudget() : max_ns(-1), max_units(SIZE_MAX), max_delay(8) {}
+
+    int64_t max_ns;    // Time to spend, negative for no limit
+    size_t max_units;  // Units to move
+    // ProcessUpdates calls after which a deferred unit goes before all
+    // others, so that no unit starves
+    uint64_t max_delay;
+  };
+
+  // Deferred moves waiting for ProcessUpdates
+  struct UpdateBacklog {
+    size_t units;
+    uint64_t oldest_delay;  // ProcessUpdates calls the oldest one has waited
   };
 
  public:
   typedef std::function<void(int, int)> Callback;
+  typedef std::function<void(int, int, int)> TierCallback;
 
   AOI(float width, float height, float visible_range, Callback enter_callback,
       Callback leave_callback)
       : width_(width),
         height_(height),
         visible_range_(visible_range),
+        large_range_(DefaultLargeRange(visible_range)),
         enter_callback_(enter_callback),
-        leave_callback_(leave_callback) {
+        leave_callback_(leave_callback),
+        pair_event_(false),
+        in_tick_(false),
+        defer_updates_(false),
+        update_calls_(0),
+        pending_seq_(0) {
     assert(width_ >= 0);
     assert(height_ >= 0);
     assert(visible_range >= 0);
@@ -64,12 +187,58 @@ class AOI {
   // id is a custom integer
   virtual void RemoveUnit(UnitID id) = 0;
 
-  // Add unit to AOI
+  // Add unit to AOI with the given role flags, visible range, visibility mask
+  // and layer
   // id is a custom integer
-  virtual void AddUnit(UnitID id, float x, float y) = 0;
+  virtual void AddUnit(UnitID id, float x, float y, int flags, float range,
+                       uint32_t mask, int layer) = 0;
+
+  // Add unit to AOI with the given role flags and visible range
+  void AddUnit(UnitID id, float x, float y, int flags, float range) {
+    AddUnit(id, x, y, flags, range, kAllMask, 0);
+  }
+
+  // Add unit which both watches and is watched, with default visible range
+  void AddUnit(UnitID id, float x, float y) {
+    AddUnit(id, x, y, kWatcher | kMarker, visible_range_);
+  }
+
+  // Load units into an empty AOI much faster than adding them one by one: the
+  // index is built in one pass and all relations are found by one sweep.
+  // Enter events are fired only if notify is true
+  void BulkLoad(const BulkUnit* units, size_t count, bool notify) {
+    std::vector<Unit*> new_units = LoadUnits(units, count);
+    SweepRelations(new_units, notify);
+  }
+
+  void BulkLoad(const std::vector<BulkUnit>& units, bool notify) {
+    BulkLoad(units.data(), units.size(), notify);
+  }
+
+  // Remove all units without firing leave events
+  void Clear() {
+    ClearIndex();
+    for (const auto& pair : unit_map_) {
+      DeleteUnit(pair.second);
+    }
+    unit_map_.clear();
+    watcher_ranges_.clear();
+    large_watchers_.clear();
+    coverage_cells_.clear();
+    broadcast_watchers_.clear();
+    edge_map_.clear();
+    tick_event_map_.clear();
+    tick_removed_ids_.clear();
+    tick_tier_map_.clear();
+    pending_updates_.clear();
+    pending_queue_.clear();
+    pending_heap_.clear();
+  }
 
-  // Find units in range near the given id, and exclude id itself
+  // Find units in range near the given id which are in the same layer and
+  // match its mask, and exclude id itself
   std::unordered_set<int> FindNearbyUnit(UnitID id, float range) const {
+    AOI_STAT(ScopedLatency latency(&stats_.query_latency));
     Unit* unit = get_unit(id);
     UnitSet unit_set = FindNearbyUnit(unit, range);
     std::unordered_set<int> id_set;
@@ -79,29 +248,362 @@ class AOI {
     return id_set;
   };
 
+  // Find units of layer which match mask inside shape, which need not be
+  // centred on a unit. Their ids are appended to result in no particular
+  // order, and their count is returned
+  size_t FindInShape(const AOIShape& shape, int layer, uint32_t mask,
+                     std::vector<UnitID>* result) const {
+    AOI_STAT(ScopedLatency latency(&stats_.query_latency));
+    ShapeCandidates& candidates = shape_candidates_;
+    candidates.Clear();
+    CollectInShape(shape, layer, mask, &candidates);
+
+    size_t count = candidates.units.size();
+    candidates.inside.resize(count);
+    shape.Contains(candidates.xs.data(), candidates.ys.data(), count,
+                   candidates.inside.data());
+    size_t old_size = result->size();
+    for (size_t i = 0; i < count; ++i) {
+      if (candidates.inside[i]) {
+        result->push_back(candidates.units[i]->id);
+      }
+    }
+    return result->size() - old_size;
+  }
+
+  // Count units of layer in the square of range around (x, y), whatever
+  // their mask. No unit set is built, and the models count whole towers or
+  // tree nodes inside the square at once
+  size_t CountInRange(float x, float y, float range, int layer) const {
+    AOI_STAT(ScopedLatency latency(&stats_.query_latency));
+    return CountInBox(x - range, y - range, x + range, y + range, layer);
+  }
+
+  // Count units of layer in each cell of a grid over the map, row major with
+  // ceil(height / cell_size) rows and ceil(width / cell_size) columns. Units
+  // beyond the map are counted in the nearest border cell, and units on the
+  // edge of two cells in either of them
+  std::vector<uint32_t> DensityGrid(float cell_size, int layer) const {
+    assert(cell_size > 0);
+    GridLayout grid(cell_size, width_, height_);
+    std::vector<uint32_t> counts(static_cast<size_t>(grid.rows) * grid.cols);
+    FillDensityGrid(grid, layer, counts.data());
+    return counts;
+  }
+
   // Find units in the subscribe set of given id
   std::unordered_set<int> GetSubScribeSet(UnitID id) const {
     Unit* unit = get_unit(id);
-    UnitSet subscribe_set = unit->subscribe_set;
     std::unordered_set<int> id_set;
-    for (const auto& unit : subscribe_set) {
-      id_set.insert(unit->id);
+    if (pair_event_) {
+      for (Edge* edge = unit->edge_head; nullptr != edge;
+           edge = edge->Next(unit)) {
+        id_set.insert(edge->Other(unit)->id);
+      }
+      return id_set;
+    }
+
+    for (const auto& pair : unit->relation_map) {
+      if (pair.second & kSubscribe) {
+        id_set.insert(pair.first->id);
+      }
     }
     return id_set;
   };
 
+  // In pair event mode, a single enter or leave event (a, b) with a < b is
+  // fired per pair of units instead of one event for each direction, and the
+  // relation is stored once per pair.
+  // All units must both watch and be watched with the default visible range.
+  // Must be set before any unit is added
+  void SetPairEvent(bool pair_event) {
+    assert(unit_map_.empty());
+    pair_event_ = pair_event;
+  }
+
+  // Watchers whose visible range exceeds range, by default four times the
+  // default visible range, are kept out of the index queries of other
+  // units, which would otherwise all widen to the largest range. Markers
+  // find them in a coarse grid of the cells their ranges cover instead, and
+  // watchers covering the whole map in a broadcast list. Must be set before
+  // any unit is added
+  void SetLargeRange(float range) {
+    assert(unit_map_.empty());
+    assert(range > 0);
+    large_range_ = range;
+  }
+
+  // Large range until SetLargeRange is called
+  static float DefaultLargeRange(float visible_range) {
+    return visible_range > 0 ? visible_range * 4 : HUGE_VALF;
+  }
+
+  // Split visible ranges into tiers by the given ascending bounds, e.g. for
+  // levels of detail: a unit seen within bounds[0] is in tier 0, within
+  // bounds[1] in tier 1, and so on up to the visible range. Distances are
+  // measured like visible ranges, along the farther axis. Subscriptions are
+  // classified by the query of each update, and tier_callback(id, other_id,
+  // tier) is fired after the enter event with the first tier, then whenever
+  // the tier changes. Must be set before any unit is added
+  void SetRangeTiers(const std::vector<float>& bounds,
+                     TierCallback tier_callback) {
+    assert(unit_map_.empty());
+    assert(std::is_sorted(bounds.begin(), bounds.end()));
+    assert(nullptr != tier_callback);
+    tier_bounds_ = bounds;
+    tier_callback_ = tier_callback;
+  }
+
+  // Tier of other_id in the subscriptions of id, -1 if id does not watch it
+  // or no tiers are set
+  int GetTier(UnitID id, UnitID other_id) const {
+    auto it = unit_map_.find(id);
+    auto other_it = unit_map_.find(other_id);
+    if (!IsTiered() || it == unit_map_.end() || other_it == unit_map_.end()) {
+      return -1;
+    }
+    if (pair_event_) {
+      auto edge_it = edge_map_.find(PairKey(id, other_id));
+      return edge_it == edge_map_.end() ? -1 : edge_it->second.tier;
+    }
+    const RelationMap& relation_map = it->second->relation_map;
+    auto relation_it = relation_map.find(other_it->second);
+    if (relation_it == relation_map.end() ||
+        !(relation_it->second & kSubscribe)) {
+      return -1;
+    }
+    return relation_it->second >> kTierShift;
+  }
+
+  // Begin a tick, enter and leave events are not fired until EndTick
+  void BeginTick() {
+    assert(!in_tick_);
+    in_tick_ = true;
+  }
+
+  // End a tick and fire the net events since BeginTick, an enter and a leave
+  // of the same pair within a tick cancel each other out. A leave followed
+  // by an enter is kept if either unit was removed during the tick, as the
+  // id was given to another entity
+  void EndTick() {
+    assert(in_tick_);
+    in_tick_ = false;
+
+    // Callbacks may begin another tick or move units, so the events of this
+    // tick are taken out first
+    std::unordered_map<uint64_t, int> events;
+    std::unordered_map<uint64_t, int> tiers;
+    events.swap(tick_event_map_);
+    tiers.swap(tick_tier_map_);
+    tick_removed_ids_.clear();
+
+    // Leave events go first, so that receivers never see stale units
+    for (const auto& pair : events) {
+      if (pair.second < 0 || kTickReplace == pair.second) {
+        AOI_STAT(++stats_.leave_events);
+        leave_callback_(static_cast<UnitID>(pair.first >> 32),
+                        static_cast<UnitID>(pair.first & 0xffffffff));
+      }
+    }
+    for (const auto& pair : events) {
+      if (pair.second > 0) {
+        AOI_STAT(++stats_.enter_events);
+        enter_callback_(static_cast<UnitID>(pair.first >> 32),
+                        static_cast<UnitID>(pair.first & 0xffffffff));
+      }
+    }
+
+    // Tier events of the subscriptions whose tier differs from the one
+    // before the tick, or which are new or replaced
+    for (const auto& pair : tiers) {
+      UnitID id = static_cast<UnitID>(pair.first >> 32);
+      UnitID other_id = static_cast<UnitID>(pair.first & 0xffffffff);
+      int tier = GetTier(id, other_id);
+      auto event_it = events.find(pair.first);
+      bool replaced =
+          event_it != events.end() && kTickReplace == event_it->second;
+      if (tier >= 0 && (tier != pair.second || replaced)) {
+        tier_callback_(id, other_id, tier);
+      }
+    }
+  }
+
+  // In deferred mode UpdateUnit only records the new position, and the unit
+  // keeps its old one for queries and events until ProcessUpdates moves it.
+  // A later move of the same unit replaces the recorded one. Callbacks fired
+  // by ProcessUpdates move units at once, which also replaces their recorded
+  // moves. Leaving the mode moves every deferred unit
+  void SetDeferUpdates(bool defer_updates) {
+    if (!defer_updates && defer_updates_) {
+      ProcessUpdates(UpdateBudget());
+    }
+    defer_updates_ = defer_updates;
+  }
+
+  // Move deferred units and fire their events until the budget is spent,
+  // and at least one unit per call. Units overdue by max_delay go first,
+  // oldest first, then watchers, which are usually players, before units
+  // only watched, then the longest moves. Returns the number of units moved
+  size_t ProcessUpdates(const UpdateBudget& budget) {
+    ++update_calls_;
+    if (pending_updates_.empty()) {
+      pending_queue_.clear();
+      pending_heap_.clear();
+      return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool defer_updates = defer_updates_;
+    defer_updates_ = false;
+    size_t moved = 0;
+    while (!pending_updates_.empty() && moved < budget.max_units) {
+      if (moved > 0 && budget.max_ns >= 0 &&
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+                  .count() >= budget.max_ns) {
+        break;
+      }
+      auto it = pending_updates_.find(PopPendingUpdate(budget.max_delay));
+      UnitID id = it->first;
+      PendingUpdate update = it->second;
+      pending_updates_.erase(it);
+      UpdateUnit(id, update.x, update.y);
+      ++moved;
+    }
+    defer_updates_ = defer_updates;
+    return moved;
+  }
+
+  UpdateBacklog GetUpdateBacklog() const {
+    UpdateBacklog backlog{pending_updates_.size(), 0};
+    for (const auto& pair : pending_queue_) {
+      auto it = pending_updates_.find(pair.second);
+      if (it != pending_updates_.end() && it->second.seq == pair.first) {
+        backlog.oldest_delay = update_calls_ - it->second.since;
+        break;
+      }
+    }
+    return backlog;
+  }
+
+  // Counters and latency histograms of the models, all zero unless built
+  // with -DAOI_STATS
+  const AOIStats& GetStats() const {
+#ifdef AOI_STATS
+    return stats_;
+#else
+    static const AOIStats empty_stats;
+    return empty_stats;
+#endif
+  }
+
+  void ResetStats() { AOI_STAT(stats_ = AOIStats()); }
+
   const float& get_width() const { return width_; }
   const float& get_height() const { return height_; }
+  float get_visible_range() const { return visible_range_; }
+  bool get_pair_event() const { return pair_event_; }
+  bool get_defer_updates() const { return defer_updates_; }
+  const std::vector<float>& get_tier_bounds() const { return tier_bounds_; }
+  bool IsTiered() const { return nullptr != tier_callback_; }
+  float get_large_range() const { return large_range_; }
 
  protected:
-  // Find units in the given range
+  // Find units in the given range, which are in the same layer as unit and
+  // match its mask
   virtual UnitSet FindNearbyUnit(const Unit* unit, float range) const = 0;
 
   virtual Unit* NewUnit(UnitID id, float x, float y) = 0;
   virtual void DeleteUnit(Unit* unit) = 0;
 
-  void ValidatePosition(float x, float y) {
-    assert(x <= width_ && y <= height_);
+  // Units found by the broad phase of a shape query. Their positions are
+  // copied into flat arrays, so that the narrow phase tests them in batch
+  struct ShapeCandidates {
+    void Push(const Unit* unit) {
+      units.push_back(unit);
+      xs.push_back(unit->x);
+      ys.push_back(unit->y);
+    }
+
+    void Clear() {
+      units.clear();
+      xs.clear();
+      ys.clear();
+    }
+
+    std::vector<const Unit*> units;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<uint8_t> inside;
+  };
+
+  // Collect units of layer which match mask and may be inside shape
+  virtual void CollectInShape(const AOIShape& shape, int layer, uint32_t mask,
+                              ShapeCandidates* candidates) const = 0;
+
+  // Cells of a density grid
+  struct GridLayout {
+    GridLayout(float cell_size_, float width, float height)
+        : cell_size(cell_size_),
+          rows(std::max(static_cast<int>(ceil(height / cell_size)), 1)),
+          cols(std::max(static_cast<int>(ceil(width / cell_size)), 1)) {}
+
+    int Row(float y) const {
+      return static_cast<int>(
+          std::clamp(floorf(y / cell_size), 0.0f, rows - 1.0f));
+    }
+
+    int Col(float x) const {
+      return static_cast<int>(
+          std::clamp(floorf(x / cell_size), 0.0f, cols - 1.0f));
+    }
+
+    size_t Index(int row, int col) const {
+      return static_cast<size_t>(row) * cols + col;
+    }
+
+    float const cell_size;
+    int const rows;
+    int const cols;
+  };
+
+  // Count units of layer in the box, by default by scanning all units
+  virtual size_t CountInBox(float x1, float y1, float x2, float y2,
+                            int layer) const {
+    size_t count = 0;
+    for (const auto& pair : unit_map_) {
+      const Unit* unit = pair.second;
+      count += unit->layer == layer && unit->x >= x1 && unit->x <= x2 &&
+               unit->y >= y1 && unit->y <= y2;
+    }
+    return count;
+  }
+
+  // Add the units of layer to the counts of their cells, by default by
+  // scanning all units
+  virtual void FillDensityGrid(const GridLayout& grid, int layer,
+                               uint32_t* counts) const {
+    for (const auto& pair : unit_map_) {
+      const Unit* unit = pair.second;
+      if (unit->layer == layer) {
+        ++counts[grid.Index(grid.Row(unit->y), grid.Col(unit->x))];
+      }
+    }
+  }
+
+  // Insert units into an empty index at once
+  virtual void BuildIndex(const std::vector<Unit*>& units) = 0;
+
+  // Empty the index, units are deleted by the caller
+  virtual void ClearIndex() = 0;
+
+  // Whether a unit may be placed at (x, y), by default within the map
+  virtual bool IsValidPosition(float x, float y) const {
+    return x >= 0 && x <= width_ && y >= 0 && y <= height_;
+  }
+
+  void ValidatePosition(float x, float y) const {
+    assert(IsValidPosition(x, y));
   }
 
   void ValidatetUnitID(UnitID id) {
@@ -114,7 +616,10 @@ class AOI {
     return unit;
   }
 
-  float get_visible_range() const { return visible_range_; }
+  // Largest visible range of watchers which are not large
+  float get_max_watcher_range() const {
+    return watcher_ranges_.empty() ? 0 : *watcher_ranges_.rbegin();
+  }
 
   const std::unordered_map<int, Unit*>& get_unit_map() const {
     return unit_map_;
@@ -131,77 +636,810 @@ class AOI {
     return unit_ids;
   }
 
-  UnitSet Intersection(const UnitSet& set, const UnitSet& other) const {
-    UnitSet res;
-    for (const auto& unit : set) {
-      if (other.find(unit) != other.end()) {
-        res.insert(unit);
+  // Whether marker is in the visible range of watcher
+  bool CanWatch(const Unit* watcher, const Unit* marker) const {
+    return watcher->IsWatcher() && marker->IsMarker() &&
+           watcher->Matches(marker) &&
+           fabs(watcher->x - marker->x) <= watcher->range &&
+           fabs(watcher->y - marker->y) <= watcher->range;
+  }
+
+  // Bounded max heap of the k nearest units found so far, ordered by squared
+  // distance then id, so that all models agree on ties
+  class NearestHeap {
+   public:
+    NearestHeap(size_t k, float max_range)
+        : k_(k), max_distance_sq_(max_range * max_range) {
+      heap_.reserve(k);
+    }
+
+    // Squared distance a unit must not exceed to be kept, negative if k is 0
+    float bound() const {
+      if (heap_.size() < k_) {
+        return max_distance_sq_;
+      }
+      return heap_.empty() ? -1 : heap_.front().first;
+    }
+
+    void Push(const Unit* unit, float distance_sq) {
+      if (distance_sq > bound()) {
+        return;
+      }
+      std::pair<float, UnitID> item(distance_sq, unit->id);
+      if (heap_.size() == k_) {
+        if (!(item < heap_.front())) {
+          return;
+        }
+        std::pop_heap(heap_.begin(), heap_.end());
+        heap_.pop_back();
+      }
+      heap_.push_back(item);
+      std::push_heap(heap_.begin(), heap_.end());
+    }
+
+    // Write units sorted by distance into result and return their count
+    size_t Output(Neighbor* result) {
+      std::sort_heap(heap_.begin(), heap_.end());
+      for (size_t i = 0; i < heap_.size(); ++i) {
+        result[i] = {heap_[i].second, sqrtf(heap_[i].first)};
+      }
+      return heap_.size();
+    }
+
+   private:
+    size_t const k_;
+    float const max_distance_sq_;
+    std::vector<std::pair<float, UnitID>> heap_;
+  };
+
+  // Range to query around unit, which covers both the markers it can watch
+  // and the watchers which can watch it
+  float GetQueryRange(const Unit* unit) const {
+    float range = 0;
+    if (unit->IsWatcher()) {
+      range = unit->range;
+    }
+    if (unit->IsMarker()) {
+      range = std::max(range, get_max_watcher_range());
+    }
+    return range;
+  }
+
+  // Cells of the coverage grid of large watchers, at most kCoverageCells on
+  // a side
+  static constexpr float kCoverageCells = 64;
+
+  bool IsLarge(const Unit* unit) const {
+    return unit->IsWatcher() && unit->range > large_range_;
+  }
+
+  GridLayout GetCoverageGrid() const {
+    return GridLayout(
+        std::max(large_range_, std::max(width_, height_) / kCoverageCells),
+        width_, height_);
+  }
+
+  // Register a new watcher, large ones in the coverage grid
+  void AddWatcher(Unit* unit) {
+    if (!unit->IsWatcher()) {
+      return;
+    }
+    if (!IsLarge(unit)) {
+      watcher_ranges_.insert(unit->range);
+      return;
+    }
+    if (coverage_cells_.empty()) {
+      GridLayout grid = GetCoverageGrid();
+      coverage_cells_.resize(static_cast<size_t>(grid.rows) * grid.cols);
+    }
+    Cover(unit, &large_watchers_[unit]);
+  }
+
+  void RemoveWatcher(Unit* unit) {
+    if (!unit->IsWatcher()) {
+      return;
+    }
+    if (!IsLarge(unit)) {
+      watcher_ranges_.erase(watcher_ranges_.find(unit->range));
+      return;
+    }
+    auto it = large_watchers_.find(unit);
+    Uncover(unit, it->second);
+    large_watchers_.erase(it);
+  }
+
+  // Move a large watcher to the cells covered from its new position
+  void MoveWatcher(Unit* unit) {
+    if (!IsLarge(unit)) {
+      return;
+    }
+    Coverage& coverage = large_watchers_[unit];
+    Coverage new_coverage = GetCoverage(unit);
+    if (new_coverage.start_row != coverage.start_row ||
+        new_coverage.start_col != coverage.start_col ||
+        new_coverage.end_row != coverage.end_row ||
+        new_coverage.end_col != coverage.end_col) {
+      Uncover(unit, coverage);
+      Cover(unit, &coverage);
+    }
+  }
+
+  // Units which may be related to unit: the index is queried around it, and
+  // the large watchers covering its cell are added. Watchers covering the
+  // whole map scan all units rather than the index
+  UnitSet FindRelationCandidates(const Unit* unit) const {
+    UnitSet near_set;
+    if (IsLarge(unit) && unit->range >= std::max(width_, height_)) {
+      near_set.reserve(unit_map_.size());
+      for (const auto& pair : unit_map_) {
+        if (pair.second != unit && pair.second->Matches(unit)) {
+          near_set.insert(pair.second);
+        }
       }
+    } else {
+      near_set = FindNearbyUnit(unit, GetQueryRange(unit));
+    }
+    if (large_watchers_.empty() || !unit->IsMarker()) {
+      return near_set;
+    }
+
+    GridLayout grid = GetCoverageGrid();
+    const std::vector<Unit*>& cell =
+        coverage_cells_[grid.Index(grid.Row(unit->y), grid.Col(unit->x))];
+    for (const std::vector<Unit*>* watchers : {&cell, &broadcast_watchers_}) {
+      for (Unit* watcher : *watchers) {
+        if (watcher != unit && watcher->Matches(unit)) {
+          near_set.insert(watcher);
+        }
+      }
+    }
+    return near_set;
+  }
+
+  int GetRelation(const Unit* unit, const Unit* other) const {
+    return (CanWatch(unit, other) ? kSubscribe : 0) |
+           (CanWatch(other, unit) ? kObserved : 0);
+  }
+
+  // Relations hold the range tier of the pair above the flags
+  static constexpr int kTierShift = 2;
+  static constexpr int kRelationMask = kSubscribe | kObserved;
+
+  // Range tier of the distance between unit and other
+  int GetDistanceTier(const Unit* unit, const Unit* other) const {
+    float distance =
+        std::max(fabsf(unit->x - other->x), fabsf(unit->y - other->y));
+    return std::lower_bound(tier_bounds_.begin(), tier_bounds_.end(),
+                            distance) -
+           tier_bounds_.begin();
+  }
+
+  // Fire the tier event of id watching other_id, or record the tier before
+  // the tick. A tier of -1 means no subscription
+  void FireTier(UnitID id, UnitID other_id, int old_tier, int tier) {
+    if (in_tick_) {
+      uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(id)) << 32 |
+                     static_cast<uint32_t>(other_id);
+      tick_tier_map_.insert(std::pair(key, old_tier));
+    } else if (tier >= 0) {
+      tier_callback_(id, other_id, tier);
     }
-    return res;
   }
 
-  UnitSet Difference(const UnitSet& set, const UnitSet& other) const {
-    UnitSet res;
-    for (const auto& unit : set) {
-      if (other.find(unit) == other.end()) {
-        res.insert(unit);
+  // Fire the tier events of both directions between unit and other, whose
+  // relation changed from old_relation to relation
+  void NotifyTier(const Unit* unit, const Unit* other, int old_relation,
+                  int relation) {
+    int old_tier = old_relation >> kTierShift;
+    int tier = relation >> kTierShift;
+    const Unit* units[2] = {unit, other};
+    const int flags[2] = {kSubscribe, kObserved};
+    for (int i = 0; i < 2; ++i) {
+      bool old_watch = old_relation & flags[i];
+      bool watch = relation & flags[i];
+      if (old_watch != watch || (watch && old_tier != tier)) {
+        FireTier(units[i]->id, units[1 - i]->id, old_watch ? old_tier : -1,
+                 watch ? tier : -1);
       }
     }
-    return res;
   }
 
-  void NotifyEnter(Unit* unit, const UnitSet& enter_set) const {
-    for (const auto& other : enter_set) {
-      enter_callback_(other->id, unit->id);
-      other->Subscribe(unit);
-      enter_callback_(unit->id, other->id);
-      unit->Subscribe(other);
+  // Fire enter events for the new relations between unit and near units
+  void NotifyEnter(Unit* unit, const UnitSet& near_set) {
+    RelationMap& relation_map = unit->relation_map;
+    for (const auto& other : near_set) {
+      auto it = relation_map.find(other);
+      int old_relation = it == relation_map.end() ? 0 : it->second;
+      int related = GetRelation(unit, other);
+      int relation = old_relation | related;
+      if (IsTiered() && 0 != related) {
+        relation = (relation & kRelationMask) |
+                   GetDistanceTier(unit, other) << kTierShift;
+      }
+      if (relation == old_relation) {
+        continue;
+      }
+      AOI_STAT(stats_.relation_inserts += 0 == old_relation);
+
+      if (!(old_relation & kObserved) && (relation & kObserved)) {
+        FireEnter(other->id, unit->id);
+      }
+      if (!(old_relation & kSubscribe) && (relation & kSubscribe)) {
+        FireEnter(unit->id, other->id);
+      }
+      unit->Relate(other, relation);
+      if (IsTiered()) {
+        // Directions which no longer hold are left to NotifyLeave
+        NotifyTier(unit, other, old_relation,
+                   relation & (related | ~kRelationMask));
+      }
     }
   }
 
-  void NotifyLeave(Unit* unit, const UnitSet& leave_set) const {
-    for (const auto& other : leave_set) {
-      leave_callback_(other->id, unit->id);
-      other->UnSubscribe(unit);
-      leave_callback_(unit->id, other->id);
-      unit->UnSubscribe(other);
+  // Fire leave events for the relations of unit which no longer hold, or for
+  // all of its relations if unit is being removed
+  void NotifyLeave(Unit* unit, bool remove) {
+    RelationMap& relation_map = unit->relation_map;
+    auto it = relation_map.begin();
+    while (it != relation_map.end()) {
+      Unit* other = it->first;
+      int old_relation = it->second;
+      // The tier is kept as long as a direction holds
+      int kept = GetRelation(unit, other) | ~kRelationMask;
+      int relation = remove ? 0 : old_relation & kept;
+      if (0 == (relation & kRelationMask)) {
+        relation = 0;
+      }
+      if (relation == old_relation) {
+        ++it;
+        continue;
+      }
+      if (IsTiered()) {
+        NotifyTier(unit, other, old_relation, relation);
+      }
+
+      if ((old_relation & kObserved) && !(relation & kObserved)) {
+        FireLeave(other->id, unit->id);
+      }
+      if ((old_relation & kSubscribe) && !(relation & kSubscribe)) {
+        FireLeave(unit->id, other->id);
+      }
+      if (0 == relation) {
+        other->relation_map.erase(unit);
+        it = relation_map.erase(it);
+      } else {
+        unit->Relate(other, relation);
+        ++it;
+      }
+    }
+  }
+
+  // Record the event of the pair during a tick, or cancel the opposite one
+  void RecordTickEvent(UnitID id, UnitID other_id, int event) {
+    uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(id)) << 32 |
+                   static_cast<uint32_t>(other_id);
+    auto it = tick_event_map_.find(key);
+    if (it == tick_event_map_.end()) {
+      tick_event_map_.insert(std::pair(key, event));
+    } else if (kTickReplace == it->second) {
+      // The new relation left again, the old one is still gone
+      assert(event < 0);
+      it->second = event;
+    } else if (event > 0 && (tick_removed_ids_.count(id) > 0 ||
+                             tick_removed_ids_.count(other_id) > 0)) {
+      assert(it->second < 0);
+      it->second = kTickReplace;
+    } else {
+      assert(it->second == -event);
+      tick_event_map_.erase(it);
+    }
+  }
+
+  void FireEnter(UnitID id, UnitID other_id) {
+    if (in_tick_) {
+      RecordTickEvent(id, other_id, 1);
+    } else {
+      AOI_STAT(++stats_.enter_events);
+      enter_callback_(id, other_id);
+    }
+  }
+
+  void FireLeave(UnitID id, UnitID other_id) {
+    if (in_tick_) {
+      RecordTickEvent(id, other_id, -1);
+    } else {
+      AOI_STAT(++stats_.leave_events);
+      leave_callback_(id, other_id);
+    }
+  }
+
+  static uint64_t PairKey(UnitID id, UnitID other_id) {
+    if (id > other_id) {
+      std::swap(id, other_id);
+    }
+    return static_cast<uint64_t>(static_cast<uint32_t>(id)) << 32 |
+           static_cast<uint32_t>(other_id);
+  }
+
+  Edge* LinkEdge(Unit* unit, Unit* other) {
+    AOI_STAT(++stats_.relation_inserts);
+    Edge* edge = &edge_map_[PairKey(unit->id, other->id)];
+    if (IsTiered()) {
+      edge->tier = GetDistanceTier(unit, other);
+    }
+    edge->units[0] = unit;
+    edge->units[1] = other;
+    for (int i = 0; i < 2; ++i) {
+      Unit* p = edge->units[i];
+      edge->nexts[i] = p->edge_head;
+      if (nullptr != p->edge_head) {
+        p->edge_head->prevs[p->edge_head->Slot(p)] = edge;
+      }
+      p->edge_head = edge;
+    }
+    return edge;
+  }
+
+  void UnlinkEdge(Edge* edge) {
+    for (int i = 0; i < 2; ++i) {
+      Unit* p = edge->units[i];
+      if (nullptr != edge->prevs[i]) {
+        edge->prevs[i]->nexts[edge->prevs[i]->Slot(p)] = edge->nexts[i];
+      } else {
+        p->edge_head = edge->nexts[i];
+      }
+      if (nullptr != edge->nexts[i]) {
+        edge->nexts[i]->prevs[edge->nexts[i]->Slot(p)] = edge->prevs[i];
+      }
+    }
+    edge_map_.erase(PairKey(edge->units[0]->id, edge->units[1]->id));
+  }
+
+  void NotifyPairEnter(Unit* unit, const UnitSet& near_set) {
+    for (const auto& other : near_set) {
+      if (!CanWatch(unit, other)) {
+        continue;
+      }
+      UnitID id = std::min(unit->id, other->id);
+      UnitID other_id = std::max(unit->id, other->id);
+      auto it = edge_map_.find(PairKey(id, other_id));
+      if (it == edge_map_.end()) {
+        FireEnter(id, other_id);
+        Edge* edge = LinkEdge(unit, other);
+        if (IsTiered()) {
+          FireTier(id, other_id, -1, edge->tier);
+        }
+      } else if (IsTiered()) {
+        int tier = GetDistanceTier(unit, other);
+        if (tier != it->second.tier) {
+          FireTier(id, other_id, it->second.tier, tier);
+          it->second.tier = tier;
+        }
+      }
+    }
+  }
+
+  void NotifyPairLeave(Unit* unit, bool remove) {
+    Edge* edge = unit->edge_head;
+    while (nullptr != edge) {
+      Edge* next = edge->Next(unit);
+      Unit* other = edge->Other(unit);
+      if (remove || !CanWatch(unit, other)) {
+        UnitID id = std::min(unit->id, other->id);
+        UnitID other_id = std::max(unit->id, other->id);
+        FireLeave(id, other_id);
+        if (IsTiered()) {
+          FireTier(id, other_id, edge->tier, -1);
+        }
+        UnlinkEdge(edge);
+      }
+      edge = next;
+    }
+  }
+
+  // Create units into an empty AOI and build the index, without relations
+  std::vector<Unit*> LoadUnits(const BulkUnit* units, size_t count) {
+    assert(unit_map_.empty());
+    unit_map_.reserve(count);
+    std::vector<Unit*> new_units(count);
+    for (size_t i = 0; i < count; ++i) {
+      const BulkUnit& bulk_unit = units[i];
+      ValidatetUnitID(bulk_unit.id);
+      Unit* unit = NewUnit(bulk_unit.id, bulk_unit.x, bulk_unit.y);
+      unit->flags = bulk_unit.flags;
+      unit->range = bulk_unit.range < 0 ? visible_range_ : bulk_unit.range;
+      unit->mask = bulk_unit.mask;
+      unit->layer = bulk_unit.layer;
+      assert(!pair_event_ || (unit->flags == (kWatcher | kMarker) &&
+                              unit->range == visible_range_));
+      unit_map_.insert(std::pair(unit->id, unit));
+      AddWatcher(unit);
+      new_units[i] = unit;
+    }
+
+    BuildIndex(new_units);
+    return new_units;
+  }
+
+  // Relate the given units with each other. Units are sorted by layer, strip
+  // of y and x, a strip being as high as the largest visible range of the
+  // watchers which are not large, so each unit is only compared with the
+  // units of its own and the next strip which are within range on x
+  void SweepRelations(const std::vector<Unit*>& units, bool notify) {
+    float range = get_max_watcher_range();
+    // Strips are slightly higher than range, so that rounding of y never
+    // puts units within range more than one strip apart
+    double strip_height = range > 0 ? range * (1 + 1e-5) : HUGE_VAL;
+    auto strip = [strip_height](const Unit* unit) {
+      return static_cast<int64_t>(floor(unit->y / strip_height));
+    };
+    std::vector<std::pair<int64_t, Unit*>> sorted(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+      sorted[i] = {strip(units[i]), units[i]};
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<int64_t, Unit*>& a,
+                 const std::pair<int64_t, Unit*>& b) {
+                if (a.second->layer != b.second->layer) {
+                  return a.second->layer < b.second->layer;
+                }
+                if (a.first != b.first) {
+                  return a.first < b.first;
+                }
+                return a.second->x < b.second->x;
+              });
+
+    auto relate = [this, notify](Unit* unit, Unit* other) {
+      if (pair_event_) {
+        if (CanWatch(unit, other)) {
+          Edge* edge = LinkEdge(unit, other);
+          if (notify) {
+            UnitID id = std::min(unit->id, other->id);
+            UnitID other_id = std::max(unit->id, other->id);
+            FireEnter(id, other_id);
+            if (IsTiered()) {
+              FireTier(id, other_id, -1, edge->tier);
+            }
+          }
+        }
+        return;
+      }
+
+      int relation = GetRelation(unit, other);
+      if (0 == relation) {
+        return;
+      }
+      if (IsTiered()) {
+        relation |= GetDistanceTier(unit, other) << kTierShift;
+      }
+      AOI_STAT(++stats_.relation_inserts);
+      unit->Relate(other, relation);
+      if (notify && (relation & kSubscribe)) {
+        FireEnter(unit->id, other->id);
+      }
+      if (notify && (relation & kObserved)) {
+        FireEnter(other->id, unit->id);
+      }
+      if (notify && IsTiered()) {
+        NotifyTier(unit, other, 0, relation);
+      }
+    };
+
+    size_t begin = 0;
+    while (begin < sorted.size()) {
+      int layer = sorted[begin].second->layer;
+      int64_t strip = sorted[begin].first;
+      size_t end = begin;
+      while (end < sorted.size() && sorted[end].second->layer == layer &&
+             sorted[end].first == strip) {
+        ++end;
+      }
+      size_t next_end = end;
+      while (next_end < sorted.size() &&
+             sorted[next_end].second->layer == layer &&
+             sorted[next_end].first == strip + 1) {
+        ++next_end;
+      }
+
+      size_t next_begin = end;
+      for (size_t i = begin; i < end; ++i) {
+        Unit* unit = sorted[i].second;
+        for (size_t j = i + 1;
+             j < end && sorted[j].second->x - unit->x <= range; ++j) {
+          relate(unit, sorted[j].second);
+        }
+        while (next_begin < next_end &&
+               unit->x - sorted[next_begin].second->x > range) {
+          ++next_begin;
+        }
+        for (size_t j = next_begin;
+             j < next_end && sorted[j].second->x - unit->x <= range; ++j) {
+          relate(unit, sorted[j].second);
+        }
+      }
+      begin = end;
+    }
+
+    // Large watchers reach beyond the strips, so they are related with the
+    // candidates of their own queries, skipping the pairs already related
+    if (large_watchers_.empty()) {
+      return;
+    }
+    for (Unit* unit : units) {
+      if (!IsLarge(unit)) {
+        continue;
+      }
+      for (Unit* other : FindRelationCandidates(unit)) {
+        bool related =
+            pair_event_
+                ? edge_map_.count(PairKey(unit->id, other->id)) > 0
+                : unit->relation_map.count(other) > 0;
+        if (!related) {
+          relate(unit, other);
+        }
+      }
     }
   }
 
   void OnAddUnit(Unit* unit) {
+    assert(unit->range >= 0);
+    assert(!pair_event_ || (unit->flags == (kWatcher | kMarker) &&
+                            unit->range == visible_range_));
     unit_map_.insert(std::pair(unit->id, unit));
+    AddWatcher(unit);
 
-    UnitSet enter_set = FindNearbyUnit(unit, visible_range_);
-    NotifyEnter(unit, enter_set);
-    unit->subscribe_set = std::move(enter_set);
+    UnitSet near_set = FindRelationCandidates(unit);
+    if (pair_event_) {
+      NotifyPairEnter(unit, near_set);
+    } else {
+      NotifyEnter(unit, near_set);
+    }
   }
 
   void OnUpdateUnit(Unit* unit) {
-    const UnitSet& old_set = unit->subscribe_set;
-    UnitSet new_set = FindNearbyUnit(static_cast<Unit*>(unit), visible_range_);
-    UnitSet move_set = Intersection(old_set, new_set);
-    UnitSet enter_set = Difference(new_set, move_set);
-    UnitSet leave_set = Difference(old_set, new_set);
-    unit->subscribe_set = std::move(new_set);
-    NotifyEnter(static_cast<Unit*>(unit), enter_set);
-    NotifyLeave(static_cast<Unit*>(unit), leave_set);
+    MoveWatcher(unit);
+    UnitSet near_set = FindRelationCandidates(unit);
+    if (pair_event_) {
+      NotifyPairEnter(unit, near_set);
+      NotifyPairLeave(unit, false);
+    } else {
+      NotifyEnter(unit, near_set);
+      NotifyLeave(unit, false);
+    }
+  }
+
+  // Record the move of id if updates are deferred, in which case
+  // UpdateUnit returns at once
+  bool DeferUpdate(UnitID id, float x, float y) {
+    if (!defer_updates_) {
+      // A direct move, e.g. from a callback of ProcessUpdates, supersedes
+      // the one recorded
+      if (!pending_updates_.empty()) {
+        pending_updates_.erase(id);
+      }
+      return false;
+    }
+    const Unit* unit = get_unit(id);
+    auto result = pending_updates_.insert(std::pair(
+        id, PendingUpdate{x, y, update_calls_, pending_seq_, pending_seq_}));
+    PendingUpdate& update = result.first->second;
+    if (result.second) {
+      pending_queue_.emplace_back(update.seq, id);
+    } else {
+      update.x = x;
+      update.y = y;
+      update.version = pending_seq_;
+    }
+    ++pending_seq_;
+    pending_heap_.push_back(MakePendingItem(unit, update));
+    std::push_heap(pending_heap_.begin(), pending_heap_.end(), PendingLess);
+
+    // Stale entries pile up when units move again before being processed
+    if (pending_heap_.size() > 2 * pending_updates_.size() + 64 ||
+        pending_queue_.size() > 2 * pending_updates_.size() + 64) {
+      CompactPendingUpdates();
+    }
+    return true;
+  }
+
+  // Take the next deferred unit to move, those overdue by max_delay first,
+  // in the order they were deferred
+  UnitID PopPendingUpdate(uint64_t max_delay) {
+    while (!pending_queue_.empty()) {
+      auto pair = pending_queue_.front();
+      auto it = pending_updates_.find(pair.second);
+      if (it != pending_updates_.end() && it->second.seq == pair.first) {
+        if (update_calls_ - it->second.since <= max_delay) {
+          break;
+        }
+        pending_queue_.pop_front();
+        return pair.second;
+      }
+      pending_queue_.pop_front();
+    }
+    // Every deferred unit has a heap entry of its current version
+    while (true) {
+      std::pop_heap(pending_heap_.begin(), pending_heap_.end(), PendingLess);
+      PendingItem item = pending_heap_.back();
+      pending_heap_.pop_back();
+      auto it = pending_updates_.find(item.id);
+      if (it != pending_updates_.end() && it->second.version == item.version) {
+        return item.id;
+      }
+    }
+  }
+
+  // Rebuild the queue and the heap of deferred units without stale entries
+  void CompactPendingUpdates() {
+    pending_queue_.clear();
+    pending_heap_.clear();
+    for (const auto& pair : pending_updates_) {
+      pending_queue_.emplace_back(pair.second.seq, pair.first);
+      pending_heap_.push_back(
+          MakePendingItem(get_unit(pair.first), pair.second));
+    }
+    std::sort(pending_queue_.begin(), pending_queue_.end());
+    std::make_heap(pending_heap_.begin(), pending_heap_.end(), PendingLess);
   }
 
   void OnRemoveUnit(Unit* unit) {
-    const UnitSet& subscribe_set = unit->subscribe_set;
-    NotifyLeave(unit, UnitSet(subscribe_set));
+    if (!pending_updates_.empty()) {
+      pending_updates_.erase(unit->id);
+    }
+    if (in_tick_) {
+      tick_removed_ids_.insert(unit->id);
+    }
+    if (pair_event_) {
+      NotifyPairLeave(unit, true);
+    } else {
+      NotifyLeave(unit, true);
+    }
+    RemoveWatcher(unit);
     unit_map_.erase(unit->id);
     DeleteUnit(unit);
   }
 
  private:
+  friend class AOISnapshot;
+
+  // Cells of the coverage grid a large watcher is listed in
+  struct Coverage {
+    int start_row;
+    int start_col;
+    int end_row;
+    int end_col;
+    bool broadcast;  // Covers all cells and is listed apart
+  };
+
+  Coverage GetCoverage(const Unit* unit) const {
+    GridLayout grid = GetCoverageGrid();
+    Coverage coverage;
+    coverage.start_row = grid.Row(unit->y - unit->range);
+    coverage.start_col = grid.Col(unit->x - unit->range);
+    coverage.end_row = grid.Row(unit->y + unit->range);
+    coverage.end_col = grid.Col(unit->x + unit->range);
+    coverage.broadcast = 0 == coverage.start_row &&
+                         0 == coverage.start_col &&
+                         grid.rows - 1 == coverage.end_row &&
+                         grid.cols - 1 == coverage.end_col;
+    return coverage;
+  }
+
+  // List unit in the cells it covers from its position
+  void Cover(Unit* unit, Coverage* coverage) {
+    *coverage = GetCoverage(unit);
+    if (coverage->broadcast) {
+      broadcast_watchers_.push_back(unit);
+      return;
+    }
+    GridLayout grid = GetCoverageGrid();
+    for (int row = coverage->start_row; row <= coverage->end_row; ++row) {
+      for (int col = coverage->start_col; col <= coverage->end_col; ++col) {
+        coverage_cells_[grid.Index(row, col)].push_back(unit);
+      }
+    }
+  }
+
+  static void EraseWatcher(std::vector<Unit*>* watchers, Unit* unit) {
+    auto it = std::find(watchers->begin(), watchers->end(), unit);
+    *it = watchers->back();
+    watchers->pop_back();
+  }
+
+  void Uncover(Unit* unit, const Coverage& coverage) {
+    if (coverage.broadcast) {
+      EraseWatcher(&broadcast_watchers_, unit);
+      return;
+    }
+    GridLayout grid = GetCoverageGrid();
+    for (int row = coverage.start_row; row <= coverage.end_row; ++row) {
+      for (int col = coverage.start_col; col <= coverage.end_col; ++col) {
+        EraseWatcher(&coverage_cells_[grid.Index(row, col)], unit);
+      }
+    }
+  }
+
   float width_;
   float height_;
   float visible_range_;
   mutable UnitMap unit_map_;
+  std::multiset<float> watcher_ranges_;  // Of the watchers not large
+
+  // Large watchers and the cells they are listed in, see SetLargeRange
+  float large_range_;
+  std::unordered_map<Unit*, Coverage> large_watchers_;
+  std::vector<std::vector<Unit*>> coverage_cells_;  // Row major
+  std::vector<Unit*> broadcast_watchers_;
   Callback enter_callback_;
   Callback leave_callback_;
+  bool pair_event_;
+  std::unordered_map<uint64_t, Edge> edge_map_;  // Keyed by ordered unit pair
+  bool in_tick_;
+  // Net event of each (id, other_id) pair in current tick, 1 for enter and -1
+  // for leave
+  std::unordered_map<uint64_t, int> tick_event_map_;
+  // Net event of a pair whose relation was left by a removed unit and
+  // entered by a unit added with the same id, fired as a leave and an enter
+  static constexpr int kTickReplace = 2;
+  std::unordered_set<UnitID> tick_removed_ids_;  // Removed in current tick
+  std::vector<float> tier_bounds_;
+  TierCallback tier_callback_;
+  // Tier of each (id, other_id) subscription before its first tier event in
+  // current tick, -1 if it was not subscribed
+  std::unordered_map<uint64_t, int> tick_tier_map_;
+  // Kept between shape queries to reuse its memory
+  mutable ShapeCandidates shape_candidates_;
+
+  // Moves recorded in deferred mode, since is the ProcessUpdates call
+  // count when the unit was first deferred. seq numbers the first deferral
+  // of the unit and version its last move, both from pending_seq_, so that
+  // the entries of the queue and the heap of earlier ones are told stale
+  struct PendingUpdate {
+    float x;
+    float y;
+    uint64_t since;
+    uint64_t seq;
+    uint64_t version;
+  };
+  // Heap entry of a deferred move, watchers first, then the longest moves
+  struct PendingItem {
+    bool watcher;
+    float distance_sq;
+    UnitID id;
+    uint64_t version;
+  };
+
+  static PendingItem MakePendingItem(const Unit* unit,
+                                     const PendingUpdate& update) {
+    float dx = update.x - unit->x;
+    float dy = update.y - unit->y;
+    return {unit->IsWatcher(), dx * dx + dy * dy, unit->id, update.version};
+  }
+
+  static bool PendingLess(const PendingItem& a, const PendingItem& b) {
+    if (a.watcher != b.watcher) {
+      return b.watcher;
+    }
+    if (a.distance_sq != b.distance_sq) {
+      return a.distance_sq < b.distance_sq;
+    }
+    return a.id > b.id;
+  }
+
+  bool defer_updates_;
+  std::unordered_map<UnitID, PendingUpdate> pending_updates_;
+  // (seq, id) of deferred units in the order they were first deferred, and
+  // the heap of their moves, kept between ProcessUpdates calls. Entries of
+  // units moved or removed since are skipped when they come up
+  std::deque<std::pair<uint64_t, UnitID>> pending_queue_;
+  std::vector<PendingItem> pending_heap_;
+  uint64_t update_calls_;
+  uint64_t pending_seq_;
+
+ protected:
+#ifdef AOI_STATS
+  mutable AOIStats stats_;
+#endif
 };
 
 #endif  // AOI_H
\ No newline at end of file
@@ -0,0 +1,175 @@
+#ifndef AOI_SHAPE_H
+#define AOI_SHAPE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Area of a shape query, e.g. the area of effect of a skill. Angles are in
+// radians, counterclockwise from the x axis
+struct AOIShape {
+  enum Type {
+    kCircle,  // Circle, or ring if inner_radius is positive
+    kRect,    // Rectangle rotated by angle
+    kSector,  // Sector of a circle, or of a ring if inner_radius is positive
+  };
+
+  static AOIShape Circle(float x, float y, float radius,
+                         float inner_radius = 0) {
+    AOIShape shape(kCircle, x, y, 0);
+    shape.radius = radius;
+    shape.inner_radius = inner_radius;
+    return shape;
+  }
+
+  // Rectangle centred at (x, y), half_length along angle and half_width
+  // across it. A line skill from (x0, y0) of length l is centred at
+  // (x0 + cos(angle) * l / 2, y0 + sin(angle) * l / 2)
+  static AOIShape Rect(float x, float y, float half_length, float half_width,
+                       float angle) {
+    AOIShape shape(kRect, x, y, angle);
+    shape.half_length = half_length;
+    shape.half_width = half_width;
+    return shape;
+  }
+
+  // Units within radius whose direction from (x, y) is within half_angle of
+  // angle
+  static AOIShape Sector(float x, float y, float radius, float angle,
+                         float half_angle, float inner_radius = 0) {
+    AOIShape shape(kSector, x, y, angle);
+    shape.radius = radius;
+    shape.inner_radius = inner_radius;
+    shape.half_angle = half_angle;
+    shape.cos_half_angle = cosf(half_angle);
+    return shape;
+  }
+
+  // Axis aligned bounding box
+  void GetBounds(float* x1, float* y1, float* x2, float* y2) const {
+    float extent_x = radius;
+    float extent_y = radius;
+    if (kRect == type) {
+      extent_x = half_length * fabsf(dir_x) + half_width * fabsf(dir_y);
+      extent_y = half_length * fabsf(dir_y) + half_width * fabsf(dir_x);
+    }
+    *x1 = x - extent_x;
+    *y1 = y - extent_y;
+    *x2 = x + extent_x;
+    *y2 = y + extent_y;
+  }
+
+  // Whether the shape may overlap the box, false only if it surely does not
+  bool Intersects(float x1, float y1, float x2, float y2) const {
+    if (kRect == type) {
+      // Separating axis test of two rectangles
+      float half_x = (x2 - x1) / 2;
+      float half_y = (y2 - y1) / 2;
+      float dx = x - (x1 + half_x);
+      float dy = y - (y1 + half_y);
+      float abs_x = fabsf(dir_x);
+      float abs_y = fabsf(dir_y);
+      return fabsf(dx) <= half_x + half_length * abs_x + half_width * abs_y &&
+             fabsf(dy) <= half_y + half_length * abs_y + half_width * abs_x &&
+             fabsf(dx * dir_x + dy * dir_y) <=
+                 half_length + half_x * abs_x + half_y * abs_y &&
+             fabsf(dy * dir_x - dx * dir_y) <=
+                 half_width + half_x * abs_y + half_y * abs_x;
+    }
+
+    // Nearest and farthest points of the box against the radii
+    float near_x = std::max(std::max(x1 - x, x - x2), 0.0f);
+    float near_y = std::max(std::max(y1 - y, y - y2), 0.0f);
+    float far_x = std::max(fabsf(x1 - x), fabsf(x2 - x));
+    float far_y = std::max(fabsf(y1 - y), fabsf(y2 - y));
+    if (near_x * near_x + near_y * near_y > radius * radius ||
+        far_x * far_x + far_y * far_y < inner_radius * inner_radius) {
+      return false;
+    }
+    if (kCircle == type || half_angle >= kHalfPi) {
+      return true;
+    }
+
+    // A narrow sector lies inside both half planes bounded by its edges,
+    // the box is outside if all its corners are outside one of them
+    float sin_half = sinf(half_angle);
+    float corners[4][2] = {{x1, y1}, {x2, y1}, {x1, y2}, {x2, y2}};
+    bool outside_left = true;
+    bool outside_right = true;
+    for (const auto& corner : corners) {
+      float dx = corner[0] - x;
+      float dy = corner[1] - y;
+      float forward = dx * dir_x + dy * dir_y;
+      float side = dy * dir_x - dx * dir_y;
+      outside_left = outside_left && side * cos_half_angle > forward * sin_half;
+      outside_right =
+          outside_right && -side * cos_half_angle > forward * sin_half;
+    }
+    return !outside_left && !outside_right;
+  }
+
+  // Test count points given as separate x and y arrays, inside[i] is set to
+  // whether point i is in the shape. The loops are branch free so that the
+  // compiler vectorizes them
+  void Contains(const float* xs, const float* ys, size_t count,
+                uint8_t* inside) const {
+    const float radius_sq = radius * radius;
+    const float inner_sq = inner_radius * inner_radius;
+    switch (type) {
+      case kCircle:
+        for (size_t i = 0; i < count; ++i) {
+          float dx = xs[i] - x;
+          float dy = ys[i] - y;
+          float distance_sq = dx * dx + dy * dy;
+          inside[i] = (distance_sq <= radius_sq) & (distance_sq >= inner_sq);
+        }
+        break;
+      case kRect:
+        for (size_t i = 0; i < count; ++i) {
+          float dx = xs[i] - x;
+          float dy = ys[i] - y;
+          float forward = dx * dir_x + dy * dir_y;
+          float side = dy * dir_x - dx * dir_y;
+          inside[i] =
+              (fabsf(forward) <= half_length) & (fabsf(side) <= half_width);
+        }
+        break;
+      case kSector: {
+        // forward >= cos(half_angle) * distance, both sides multiplied by
+        // their absolute value to avoid the square root
+        const float cos_sq = cos_half_angle * fabsf(cos_half_angle);
+        for (size_t i = 0; i < count; ++i) {
+          float dx = xs[i] - x;
+          float dy = ys[i] - y;
+          float distance_sq = dx * dx + dy * dy;
+          float forward = dx * dir_x + dy * dir_y;
+          inside[i] = (distance_sq <= radius_sq) &
+                      (distance_sq >= inner_sq) &
+                      (forward * fabsf(forward) >= cos_sq * distance_sq);
+        }
+        break;
+      }
+    }
+  }
+
+  Type type;
+  float x;
+  float y;
+  float dir_x;  // Unit vector of angle
+  float dir_y;
+  float radius = 0;
+  float inner_radius = 0;
+  float half_length = 0;
+  float half_width = 0;
+  float half_angle = 0;
+  float cos_half_angle = 1;
+
+ private:
+  static constexpr float kHalfPi = 1.57079632679f;
+
+  AOIShape(Type type_, float x_, float y_, float angle)
+      : type(type_), x(x_), y(y_), dir_x(cosf(angle)), dir_y(sinf(angle)) {}
+};
+
+#endif  // AOI_SHAPE_H
@@ -0,0 +1,139 @@
+#ifndef AOI_STATS_H
+#define AOI_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+// Counters of the work done inside the models. They are only collected when
+// built with -DAOI_STATS, every translation unit must agree on it.
+// AOI_STAT(statement) expands to statement only in that case, so the counting
+// code costs nothing otherwise
+#ifdef AOI_STATS
+#define AOI_STAT(...) __VA_ARGS__
+#else
+#define AOI_STAT(...)
+#endif
+
+// Latency histogram with logarithmic buckets, each power of 2 is split into
+// kSubBuckets linear buckets, so a recorded value is off by less than
+// 1/kSubBuckets. Values up to 2^kMaxBits nanoseconds are kept, larger ones
+// fall in the last bucket
+class LatencyHistogram {
+ public:
+  LatencyHistogram() { Reset(); }
+
+  void Record(uint64_t ns) {
+    ++counts_[BucketIndex(ns)];
+    ++count_;
+    sum_ += ns;
+    if (ns > max_) {
+      max_ = ns;
+    }
+  }
+
+  // Upper bound of the bucket which holds the given quantile in [0, 1]
+  uint64_t Percentile(double quantile) const {
+    if (0 == count_) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(quantile * (count_ - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        // The last bucket has no upper bound but the max
+        return i + 1 < kBucketCount ? std::min(BucketUpperBound(i), max_)
+                                    : max_;
+      }
+    }
+    return max_;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  double mean() const { return count_ > 0 ? double(sum_) / count_ : 0; }
+
+  void Reset() {
+    memset(counts_, 0, sizeof(counts_));
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+ private:
+  static const int kSubBits = 4;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kMaxBits = 40;
+  static const int kBucketCount = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  static int BucketIndex(uint64_t ns) {
+    if (ns < static_cast<uint64_t>(kSubBuckets)) {
+      return static_cast<int>(ns);
+    }
+    int bits = 63 - __builtin_clzll(ns);
+    if (bits >= kMaxBits) {
+      return kBucketCount - 1;
+    }
+    int sub = static_cast<int>(ns >> (bits - kSubBits)) & (kSubBuckets - 1);
+    return (bits - kSubBits + 1) * kSubBuckets + sub;
+  }
+
+  static uint64_t BucketUpperBound(int index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    int bits = index / kSubBuckets + kSubBits - 1;
+    uint64_t sub = index % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << (bits - kSubBits)) - 1;
+  }
+
+  uint64_t counts_[kBucketCount];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+// Record the time spent in the enclosing scope into a histogram
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(LatencyHistogram* histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedLatency() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start_)
+                  .count();
+    histogram_->Record(ns);
+  }
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+ private:
+  LatencyHistogram* const histogram_;
+  std::chrono::steady_clock::time_point const start_;
+};
+
+struct AOIStats {
+  // Spatial index searches, one per add and update plus explicit queries
+  uint64_t searches = 0;
+  // Index nodes visited by searches: occupied towers of TowerAOI, tree nodes
+  // of QuadTreeAOI, skip list nodes walked by CrosslinkAOI
+  uint64_t nodes_visited = 0;
+  // Units tested against the search range
+  uint64_t units_scanned = 0;
+  // New entries in the relation maps, or edges in pair event mode
+  uint64_t relation_inserts = 0;
+  // Events delivered to the callbacks
+  uint64_t enter_events = 0;
+  uint64_t leave_events = 0;
+
+  LatencyHistogram add_latency;
+  LatencyHistogram update_latency;
+  LatencyHistogram remove_latency;
+  LatencyHistogram query_latency;
+};
+
+#endif  // AOI_STATS_H
@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "bench/perf_counter.h"
+#include "crosslink_aoi/crosslink_aoi.h"
+#include "quadtree_aoi/quadtree_aoi.h"
+#include "snapshot/snapshot.h"
+#include "tower_aoi/tower_aoi.h"
+#include "trace/trace.h"
+
+// Benchmark of the AOI models under production-like workloads, reports
+// per-operation latency percentiles, event throughput and peak RSS
+
+struct Config {
+  std::string models = "all";
+  std::string workloads = "all";
+  std::string format = "text";
+  std::string record;
+  std::string snapshot;
+  bool perf = false;
+  int units = 2000;
+  int ticks = 20;
+  int trials = 3;
+  int layers = 1;
+  float map_size = 1024;
+  float visible_range = 30;
+  unsigned seed = 1;
+};
+
+struct Op {
+  // Tick bounds are not timed, they are only recorded into traces
+  enum Type {
+    kAdd,
+    kUpdate,
+    kRemove,
+    kQuery,
+    kTypeCount,
+    kBeginTick = kTypeCount,
+    kEndTick
+  };
+
+  Type type;
+  AOI::UnitID id;
+  float x;  // Query range for kQuery
+  float y;
+};
+
+const char* const kOpNames[Op::kTypeCount] = {"add", "update", "remove",
+                                              "query"};
+
+struct Result {
+  Result(const std::string& model_, const std::string& workload_)
+      : model(model_), workload(workload_) {}
+
+  std::string model;
+  std::string workload;
+  std::vector<int64_t> latencies[Op::kTypeCount];  // Nanoseconds
+  int64_t total_ns = 0;
+  int64_t events = 0;
+  long peak_rss_kb = 0;
+  // Work inside the spatial indices, only counted when built with -DAOI_STATS
+  uint64_t searches = 0;
+  uint64_t nodes_visited = 0;
+  uint64_t units_scanned = 0;
+  // Time to save and restore the units once they are all added, only
+  // measured with --snapshot
+  int snapshots = 0;
+  double snapshot_save_ms = 0;
+  double snapshot_load_ms = 0;
+  // Hardware counters of each op, only read with --perf
+  uint64_t counters[Op::kTypeCount][PerfCounters::kEventCount] = {};
+};
+
+// Workload generator, positions are kept inside the map
+class Workload {
+ public:
+  Workload(const Config& config, unsigned seed)
+      : config_(config), rng_(seed), positions_(config.units) {}
+
+  // Units walk a few steps per tick
+  std::vector<Op> Walk() {
+    std::vector<Op> ops;
+    std::uniform_real_distribution<float> dist(0, config_.map_size);
+    for (int i = 0; i < config_.units; ++i) {
+      Add(ops, i, dist(rng_), dist(rng_));
+    }
+    for (int t = 0; t < config_.ticks; ++t) {
+      ops.push_back({Op::kBeginTick, 0, 0, 0});
+      for (int i = 0; i < config_.units; ++i) {
+        Step(ops, i, 3);
+      }
+      ops.push_back({Op::kEndTick, 0, 0, 0});
+    }
+    RemoveAll(ops);
+    return ops;
+  }
+
+  // Most units crowd around a few towns and wander nearby
+  std::vector<Op> Hotspot() {
+    std::vector<Op> ops;
+    std::uniform_real_distribution<float> dist(0, config_.map_size);
+    std::vector<std::pair<float, float>> towns(8);
+    for (auto& town : towns) {
+      town = {dist(rng_), dist(rng_)};
+    }
+    std::normal_distribution<float> spread(0, config_.map_size / 64);
+    for (int i = 0; i < config_.units; ++i) {
+      if (i % 5 == 0) {
+        Add(ops, i, dist(rng_), dist(rng_));
+      } else {
+        const auto& town = towns[i % towns.size()];
+        Add(ops, i, town.first + spread(rng_), town.second + spread(rng_));
+      }
+    }
+    for (int t = 0; t < config_.ticks; ++t) {
+      ops.push_back({Op::kBeginTick, 0, 0, 0});
+      for (int i = 0; i < config_.units; ++i) {
+        Step(ops, i, 2);
+      }
+      ops.push_back({Op::kEndTick, 0, 0, 0});
+    }
+    RemoveAll(ops);
+    return ops;
+  }
+
+  // All units fight around a boss which slowly moves across the map
+  std::vector<Op> Raid() {
+    std::vector<Op> ops;
+    float boss_x = config_.map_size / 4;
+    float boss_y = config_.map_size / 2;
+    float boss_speed = config_.map_size / 2 / config_.ticks;
+    std::normal_distribution<float> spread(0, config_.visible_range * 2);
+    std::uniform_real_distribution<float> jitter(-1, 1);
+    for (int i = 0; i < config_.units; ++i) {
+      Add(ops, i, boss_x + spread(rng_), boss_y + spread(rng_));
+    }
+    for (int t = 0; t < config_.ticks; ++t) {
+      ops.push_back({Op::kBeginTick, 0, 0, 0});
+      for (int i = 0; i < config_.units; ++i) {
+        Move(ops, i, positions_[i].first + boss_speed + jitter(rng_),
+             positions_[i].second + jitter(rng_));
+      }
+      ops.push_back({Op::kEndTick, 0, 0, 0});
+    }
+    RemoveAll(ops);
+    return ops;
+  }
+
+  // Units walk, and a tenth of them despawn and respawn elsewhere every tick
+  std::vector<Op> Churn() {
+    std::vector<Op> ops;
+    std::uniform_real_distribution<float> dist(0, config_.map_size);
+    for (int i = 0; i < config_.units; ++i) {
+      Add(ops, i, dist(rng_), dist(rng_));
+    }
+    std::uniform_int_distribution<int> churn(0, 9);
+    for (int t = 0; t < config_.ticks; ++t) {
+      ops.push_back({Op::kBeginTick, 0, 0, 0});
+      for (int i = 0; i < config_.units; ++i) {
+        if (churn(rng_) == 0) {
+          ops.push_back({Op::kRemove, i, 0, 0});
+          Add(ops, i, dist(rng_), dist(rng_));
+        } else {
+          Step(ops, i, 3);
+        }
+      }
+      ops.push_back({Op::kEndTick, 0, 0, 0});
+    }
+    RemoveAll(ops);
+    return ops;
+  }
+
+  // A tenth of units walk and every unit queries its neighbours every tick
+  std::vector<Op> Query() {
+    std::vector<Op> ops;
+    std::uniform_real_distribution<float> dist(0, config_.map_size);
+    for (int i = 0; i < config_.units; ++i) {
+      Add(ops, i, dist(rng_), dist(rng_));
+    }
+    for (int t = 0; t < config_.ticks; ++t) {
+      ops.push_back({Op::kBeginTick, 0, 0, 0});
+      for (int i = 0; i < config_.units; ++i) {
+        if (i % 10 == t % 10) {
+          Step(ops, i, 3);
+        }
+        ops.push_back({Op::kQuery, i, config_.visible_range, 0});
+      }
+      ops.push_back({Op::kEndTick, 0, 0, 0});
+    }
+    RemoveAll(ops);
+    return ops;
+  }
+
+ private:
+  float Clamp(float v) const {
+    return std::clamp(v, 0.0f, config_.map_size);
+  }
+
+  void Add(std::vector<Op>& ops, AOI::UnitID id, float x, float y) {
+    positions_[id] = {Clamp(x), Clamp(y)};
+    ops.push_back(
+        {Op::kAdd, id, positions_[id].first, positions_[id].second});
+  }
+
+  void Move(std::vector<Op>& ops, AOI::UnitID id, float x, float y) {
+    positions_[id] = {Clamp(x), Clamp(y)};
+    ops.push_back(
+        {Op::kUpdate, id, positions_[id].first, positions_[id].second});
+  }
+
+  void Step(std::vector<Op>& ops, AOI::UnitID id, float speed) {
+    std::uniform_real_distribution<float> dist(-speed, speed);
+    Move(ops, id, positions_[id].first + dist(rng_),
+         positions_[id].second + dist(rng_));
+  }
+
+  void RemoveAll(std::vector<Op>& ops) {
+    for (int i = 0; i < config_.units; ++i) {
+      ops.push_back({Op::kRemove, i, 0, 0});
+    }
+  }
+
+  const Config& config_;
+  std::mt19937 rng_;
+  std::vector<std::pair<float, float>> positions_;
+};
+
+std::vector<Op> GenerateWorkload(const std::string& name,
+                                 const Config& config, unsigned seed) {
+  Workload workload(config, seed);
+  if (name == "walk") {
+    return workload.Walk();
+  } else if (name == "hotspot") {
+    return workload.Hotspot();
+  } else if (name == "raid") {
+    return workload.Raid();
+  } else if (name == "churn") {
+    return workload.Churn();
+  } else if (name == "query") {
+    return workload.Query();
+  }
+  return {};
+}
+
+// Hardware counters are read at the start of every run of ops of the same
+// type rather than around every op, so the reads stay cheap and out of the
+// timed code, the counts of a run are charged to its op type
+class PhaseCounters {
+ public:
+  PhaseCounters(PerfCounters* perf, Result& result)
+      : perf_(perf), result_(result), type_(-1) {}
+
+  ~PhaseCounters() { Switch(-1); }
+
+  void Switch(int type) {
+    if (nullptr == perf_ || type == type_) {
+      return;
+    }
+    uint64_t values[PerfCounters::kEventCount];
+    perf_->Read(values);
+    if (type_ >= 0) {
+      for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+        result_.counters[type_][i] += values[i] - values_[i];
+      }
+    }
+    memcpy(values_, values, sizeof(values_));
+    type_ = type;
+  }
+
+ private:
+  PerfCounters* const perf_;
+  Result& result_;
+  int type_;
+  uint64_t values_[PerfCounters::kEventCount];
+};
+
+template <class AOIImpl>
+void SnapshotTrial(const Config& config, const AOIImpl& aoi, Result& result) {
+  auto t1 = std::chrono::steady_clock::now();
+  if (!AOISnapshot::Save(aoi, config.snapshot.c_str())) {
+    fprintf(stderr, "Can not save snapshot %s\n", config.snapshot.c_str());
+    return;
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  AOIImpl restored(config.map_size, config.map_size, config.visible_range,
+                   [](int, int) {}, [](int, int) {});
+  if (!AOISnapshot::Load(config.snapshot.c_str(), &restored)) {
+    fprintf(stderr, "Can not load snapshot %s\n", config.snapshot.c_str());
+    return;
+  }
+  auto t3 = std::chrono::steady_clock::now();
+  ++result.snapshots;
+  result.snapshot_save_ms +=
+      std::chrono::duration<double, std::milli>(t2 - t1).count();
+  result.snapshot_load_ms +=
+      std::chrono::duration<double, std::milli>(t3 - t2).count();
+}
+
+template <class AOIImpl>
+void RunTrial(const Config& config, const std::vector<Op>& ops,
+              PerfCounters* perf, Result& result) {
+  int64_t events = 0;
+  auto callback = [&events](int, int) { ++events; };
+  ResetPeakRSS();
+  {
+    AOIImpl aoi(config.map_size, config.map_size, config.visible_range,
+                callback, callback);
+    size_t queried = 0;
+    PhaseCounters phase_counters(perf, result);
+    bool populated = false;
+    for (const auto& op : ops) {
+      if (!populated && op.type != Op::kAdd) {
+        populated = true;
+        if (!config.snapshot.empty()) {
+          phase_counters.Switch(-1);
+          SnapshotTrial<AOIImpl>(config, aoi, result);
+        }
+      }
+      if (op.type >= Op::kTypeCount) {
+        continue;
+      }
+      phase_counters.Switch(op.type);
+      auto t1 = std::chrono::steady_clock::now();
+      switch (op.type) {
+        case Op::kAdd:
+          aoi.AddUnit(op.id, op.x, op.y, AOI::kWatcher | AOI::kMarker,
+                      config.visible_range, AOI::kAllMask,
+                      op.id % config.layers);
+          break;
+        case Op::kUpdate:
+          aoi.UpdateUnit(op.id, op.x, op.y);
+          break;
+        case Op::kRemove:
+          aoi.RemoveUnit(op.id);
+          break;
+        case Op::kQuery:
+          queried += aoi.FindNearbyUnit(op.id, op.x).size();
+          break;
+        default:
+          break;
+      }
+      auto t2 = std::chrono::steady_clock::now();
+      int64_t ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1)
+              .count();
+      result.latencies[op.type].push_back(ns);
+      result.total_ns += ns;
+    }
+    (void)queried;
+    result.peak_rss_kb = std::max(result.peak_rss_kb, GetPeakRSS());
+    const AOIStats& stats = aoi.GetStats();
+    result.searches += stats.searches;
+    result.nodes_visited += stats.nodes_visited;
+    result.units_scanned += stats.units_scanned;
+  }
+  result.events += events;
+}
+
+// Hardware counters per op, n/a if unavailable
+void ReportCounters(const Config& config, const PerfCounters& perf,
+                    const Result& result, int type, size_t count) {
+  const uint64_t* counters = result.counters[type];
+  auto per_op = [&](int event) {
+    return double(counters[event]) / std::max<size_t>(count, 1);
+  };
+  bool ipc_available = perf.available(PerfCounters::kCycles) &&
+                       perf.available(PerfCounters::kInstructions) &&
+                       counters[PerfCounters::kCycles] > 0;
+  double ipc = ipc_available ? double(counters[PerfCounters::kInstructions]) /
+                                   counters[PerfCounters::kCycles]
+                             : 0;
+
+  if (config.format == "csv") {
+    for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+      if (perf.available(i)) {
+        printf(",%.1f", per_op(i));
+      } else {
+        printf(",");
+      }
+    }
+    if (ipc_available) {
+      printf(",%.2f", ipc);
+    } else {
+      printf(",");
+    }
+  } else if (config.format == "json") {
+    for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+      if (perf.available(i)) {
+        printf(", \"%s_per_op\": %.1f", PerfCounters::Name(i), per_op(i));
+      } else {
+        printf(", \"%s_per_op\": null", PerfCounters::Name(i));
+      }
+    }
+    if (ipc_available) {
+      printf(", \"ipc\": %.2f", ipc);
+    } else {
+      printf(", \"ipc\": null");
+    }
+  } else {
+    printf("%-10s %-8s %-7s", result.model.c_str(), result.workload.c_str(),
+           kOpNames[type]);
+    for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+      if (perf.available(i)) {
+        printf(" %14.1f", per_op(i));
+      } else {
+        printf(" %14s", "n/a");
+      }
+    }
+    if (ipc_available) {
+      printf(" %6.2f\n", ipc);
+    } else {
+      printf(" %6s\n", "n/a");
+    }
+  }
+}
+
+void Report(const Config& config, const PerfCounters* perf,
+            std::vector<Result>& results) {
+  if (config.format == "csv") {
+    printf(
+        "model,workload,op,count,p50_ns,p99_ns,p999_ns,mean_ns,total_ms,"
+        "events_per_sec,peak_rss_kb");
+    if (nullptr != perf) {
+      for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+        printf(",%s_per_op", PerfCounters::Name(i));
+      }
+      printf(",ipc");
+    }
+    printf("\n");
+  } else if (config.format == "json") {
+    printf("[\n");
+  } else {
+    printf("%-10s %-8s %-7s %10s %9s %9s %9s %9s %12s %10s\n", "model",
+           "workload", "op", "count", "p50_ns", "p99_ns", "p999_ns",
+           "mean_ns", "events/s", "rss_kb");
+  }
+
+  bool first = true;
+  for (auto& result : results) {
+    double seconds = result.total_ns / 1e9;
+    double events_per_sec = seconds > 0 ? result.events / seconds : 0;
+    for (int type = 0; type < Op::kTypeCount; ++type) {
+      std::vector<int64_t>& latencies = result.latencies[type];
+      if (latencies.empty()) {
+        continue;
+      }
+      std::sort(latencies.begin(), latencies.end());
+      double sum = 0;
+      for (auto ns : latencies) {
+        sum += ns;
+      }
+      double mean = sum / latencies.size();
+      int64_t p50 = Percentile(latencies, 0.5);
+      int64_t p99 = Percentile(latencies, 0.99);
+      int64_t p999 = Percentile(latencies, 0.999);
+
+      if (config.format == "csv") {
+        printf("%s,%s,%s,%zu,%ld,%ld,%ld,%.1f,%.3f,%.0f,%ld",
+               result.model.c_str(), result.workload.c_str(), kOpNames[type],
+               latencies.size(), p50, p99, p999, mean, seconds * 1e3,
+               events_per_sec, result.peak_rss_kb);
+        if (nullptr != perf) {
+          ReportCounters(config, *perf, result, type, latencies.size());
+        }
+        printf("\n");
+      } else if (config.format == "json") {
+        printf(
+            "%s  {\"model\": \"%s\", \"workload\": \"%s\", \"op\": \"%s\", "
+            "\"count\": %zu, \"p50_ns\": %ld, \"p99_ns\": %ld, "
+            "\"p999_ns\": %ld, \"mean_ns\": %.1f, \"total_ms\": %.3f, "
+            "\"events_per_sec\": %.0f, \"peak_rss_kb\": %ld",
+            first ? "" : ",\n", result.model.c_str(),
+            result.workload.c_str(), kOpNames[type], latencies.size(), p50,
+            p99, p999, mean, seconds * 1e3, events_per_sec,
+            result.peak_rss_kb);
+        if (nullptr != perf) {
+          ReportCounters(config, *perf, result, type, latencies.size());
+        }
+        printf("}");
+      } else {
+        printf("%-10s %-8s %-7s %10zu %9ld %9ld %9ld %9.0f %12.0f %10ld\n",
+               result.model.c_str(), result.workload.c_str(), kOpNames[type],
+               latencies.size(), p50, p99, p999, mean, events_per_sec,
+               result.peak_rss_kb);
+      }
+      first = false;
+    }
+    if (config.format == "text" && result.searches > 0) {
+      printf("%-10s %-8s searches=%lu nodes/search=%.1f units/search=%.1f\n",
+             result.model.c_str(), result.workload.c_str(), result.searches,
+             double(result.nodes_visited) / result.searches,
+             double(result.units_scanned) / result.searches);
+    }
+    if (config.format == "text" && result.snapshots > 0) {
+      printf("%-10s %-8s snapshot save=%.2fms load=%.2fms\n",
+             result.model.c_str(), result.workload.c_str(),
+             result.snapshot_save_ms / result.snapshots,
+             result.snapshot_load_ms / result.snapshots);
+    }
+  }
+
+  if (config.format == "json") {
+    printf("\n]\n");
+  }
+
+  if (config.format != "text" || nullptr == perf) {
+    return;
+  }
+  printf("\n%-10s %-8s %-7s", "model", "workload", "op");
+  for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+    printf(" %14s", (std::string(PerfCounters::Name(i)) + "/op").c_str());
+  }
+  printf(" %6s\n", "ipc");
+  for (const auto& result : results) {
+    for (int type = 0; type < Op::kTypeCount; ++type) {
+      if (!result.latencies[type].empty()) {
+        ReportCounters(config, *perf, result, type,
+                       result.latencies[type].size());
+      }
+    }
+  }
+}
+
+bool Selected(const std::string& selection, const std::string& name) {
+  return selection == "all" ||
+         ("," + selection + ",").find("," + name + ",") != std::string::npos;
+}
+
+void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --model all|tower,quadtree,crosslink  (default all)\n"
+          "  --workload all|walk,hotspot,raid,churn,query  (default all)\n"
+          "  --units N      number of units (default 2000)\n"
+          "  --ticks N      number of ticks (default 20)\n"
+          "  --trials N     trials of each workload (default 3)\n"
+          "  --layers N     spread units over N layers (default 1)\n"
+          "  --map SIZE     width and height of the map (default 1024)\n"
+          "  --range R      visible range (default 30)\n"
+          "  --seed S       random seed (default 1)\n"
+          "  --format text|csv|json  (default text)\n"
+          "  --record FILE  record the first workload into a trace file\n"
+          "  --perf on|off  read hardware counters per op (default off)\n"
+          "  --snapshot FILE  time saving and restoring units through FILE\n",
+          program);
+}
+
+bool ParseArgs(int argc, char const* argv[], Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* arg = argv[i];
+    const char* value = argv[++i];
+    if (0 == strcmp(arg, "--model")) {
+      config.models = value;
+    } else if (0 == strcmp(arg, "--workload")) {
+      config.workloads = value;
+    } else if (0 == strcmp(arg, "--units")) {
+      config.units = atoi(value);
+    } else if (0 == strcmp(arg, "--ticks")) {
+      config.ticks = atoi(value);
+    } else if (0 == strcmp(arg, "--trials")) {
+      config.trials = atoi(value);
+    } else if (0 == strcmp(arg, "--layers")) {
+      config.layers = atoi(value);
+    } else if (0 == strcmp(arg, "--map")) {
+      config.map_size = atof(value);
+    } else if (0 == strcmp(arg, "--range")) {
+      config.visible_range = atof(value);
+    } else if (0 == strcmp(arg, "--seed")) {
+      config.seed = atoi(value);
+    } else if (0 == strcmp(arg, "--format")) {
+      config.format = value;
+    } else if (0 == strcmp(arg, "--record")) {
+      config.record = value;
+    } else if (0 == strcmp(arg, "--snapshot")) {
+      config.snapshot = value;
+    } else if (0 == strcmp(arg, "--perf")) {
+      config.perf = 0 == strcmp(value, "on");
+    } else {
+      return false;
+    }
+  }
+  return config.units > 0 && config.ticks > 0 && config.trials > 0 &&
+         config.layers > 0 && config.map_size > 0 && config.visible_range > 0;
+}
+
+// Record the operations into a trace file for aoi_replay
+void RecordTrace(const Config& config, const std::vector<Op>& ops) {
+  TowerAOI aoi(config.map_size, config.map_size, config.visible_range,
+               [](int, int) {}, [](int, int) {});
+  AOIRecorder recorder(&aoi, config.record.c_str());
+  if (!recorder.IsOpen()) {
+    fprintf(stderr, "Can not open %s\n", config.record.c_str());
+    return;
+  }
+
+  for (const auto& op : ops) {
+    switch (op.type) {
+      case Op::kAdd:
+        recorder.AddUnit(op.id, op.x, op.y, AOI::kWatcher | AOI::kMarker,
+                         config.visible_range, AOI::kAllMask,
+                         op.id % config.layers);
+        break;
+      case Op::kUpdate:
+        recorder.UpdateUnit(op.id, op.x, op.y);
+        break;
+      case Op::kRemove:
+        recorder.RemoveUnit(op.id);
+        break;
+      case Op::kQuery:
+        recorder.FindNearbyUnit(op.id, op.x);
+        break;
+      case Op::kBeginTick:
+        recorder.BeginTick();
+        break;
+      case Op::kEndTick:
+        recorder.EndTick();
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+int main(int argc, char const* argv[]) {
+  Config config;
+  if (!ParseArgs(argc, argv, config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  PerfCounters perf_counters;
+  PerfCounters* perf = nullptr;
+  if (config.perf) {
+    if (perf_counters.any_available()) {
+      perf = &perf_counters;
+    } else {
+      fprintf(stderr,
+              "Hardware counters are unavailable, check "
+              "/proc/sys/kernel/perf_event_paranoid\n");
+    }
+  }
+
+  const char* const workloads[] = {"walk", "hotspot", "raid", "churn",
+                                   "query"};
+  std::vector<Result> results;
+  for (auto workload : workloads) {
+    if (!Selected(config.workloads, workload)) {
+      continue;
+    }
+
+    Result tower("tower", workload);
+    Result quadtree("quadtree", workload);
+    Result crosslink("crosslink", workload);
+    for (int trial = 0; trial < config.trials; ++trial) {
+      // Every model replays the same operations in a trial
+      std::vector<Op> ops =
+          GenerateWorkload(workload, config, config.seed + trial);
+      if (!config.record.empty() && 0 == trial) {
+        RecordTrace(config, ops);
+        config.record.clear();
+      }
+      if (Selected(config.models, "tower")) {
+        RunTrial<TowerAOI>(config, ops, perf, tower);
+      }
+      if (Selected(config.models, "quadtree")) {
+        RunTrial<QuadTreeAOI>(config, ops, perf, quadtree);
+      }
+      if (Selected(config.models, "crosslink")) {
+        RunTrial<CrosslinkAOI>(config, ops, perf, crosslink);
+      }
+    }
+
+    for (auto result : {&tower, &quadtree, &crosslink}) {
+      if (Selected(config.models, result->model)) {
+        results.push_back(std::move(*result));
+      }
+    }
+  }
+
+  Report(config, perf, results);
+  return 0;
+}
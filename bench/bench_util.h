@@ -0,0 +1,51 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Reset the peak RSS of the process, so that it can be measured per run
+inline void ResetPeakRSS() {
+  FILE* fp = fopen("/proc/self/clear_refs", "w");
+  if (nullptr != fp) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+}
+
+inline long GetPeakRSS() {
+  FILE* fp = fopen("/proc/self/status", "r");
+  if (nullptr != fp) {
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+        break;
+      }
+    }
+    fclose(fp);
+    if (kb >= 0) {
+      return kb;
+    }
+  }
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Percentile p in [0, 1] of sorted samples
+inline int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t i = std::min(sorted.size() - 1,
+                      static_cast<size_t>(p * (sorted.size() - 1) + 0.5));
+  return sorted[i];
+}
+
+#endif  // BENCH_UTIL_H
@@ -0,0 +1,126 @@
+#ifndef BENCH_PERF_COUNTER_H
+#define BENCH_PERF_COUNTER_H
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters of the calling thread, read through perf_event_open.
+// Only user space is counted, so reading the counters does not disturb them.
+// Counters which can not be opened, e.g. without a PMU in a virtual machine
+// or with a strict perf_event_paranoid, are reported as unavailable
+class PerfCounters {
+ public:
+  enum Event {
+    kCycles,
+    kInstructions,
+    kL1DMisses,
+    kLLCMisses,
+    kBranchMisses,
+    kEventCount,
+  };
+
+  PerfCounters() {
+    for (int i = 0; i < kEventCount; ++i) {
+      fds_[i] = Open(static_cast<Event>(i));
+    }
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int i = 0; i < kEventCount; ++i) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+      }
+    }
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  static const char* Name(int event) {
+    static const char* const kNames[kEventCount] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+    return kNames[event];
+  }
+
+  bool available(int event) const { return fds_[event] >= 0; }
+
+  bool any_available() const {
+    for (int i = 0; i < kEventCount; ++i) {
+      if (available(i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Read the current values, scaled up if the kernel multiplexed the
+  // counters. Unavailable counters read as 0
+  void Read(uint64_t values[kEventCount]) const {
+    for (int i = 0; i < kEventCount; ++i) {
+      values[i] = 0;
+#ifdef __linux__
+      // value, time enabled, time running
+      uint64_t data[3];
+      if (fds_[i] < 0 || read(fds_[i], data, sizeof(data)) != sizeof(data)) {
+        continue;
+      }
+      values[i] = data[2] > 0 && data[2] < data[1]
+                      ? static_cast<uint64_t>(double(data[0]) * data[1] /
+                                              data[2])
+                      : data[0];
+#endif
+    }
+  }
+
+ private:
+  static int Open(Event event) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    switch (event) {
+      case kCycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case kInstructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case kL1DMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                      PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        break;
+      case kLLCMisses:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case kBranchMisses:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      default:
+        return -1;
+    }
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    (void)event;
+    return -1;
+#endif
+  }
+
+  int fds_[kEventCount];
+};
+
+#endif  // BENCH_PERF_COUNTER_H
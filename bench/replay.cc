@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "crosslink_aoi/crosslink_aoi.h"
+#include "quadtree_aoi/quadtree_aoi.h"
+#include "tower_aoi/tower_aoi.h"
+#include "trace/trace.h"
+
+// Replay a trace recorded by AOIRecorder on every model at full speed,
+// report throughput and latency percentiles, and check that all models fire
+// the same events for the same trace
+
+const char* const kOpNames[] = {"", "add", "update", "remove", "query",
+                                "begin_tick", "end_tick", "defer_updates",
+                                "process_updates", "range_tiers",
+                                "large_range"};
+const int kOpCount = sizeof(kOpNames) / sizeof(kOpNames[0]);
+
+struct ReplayResult {
+  explicit ReplayResult(const std::string& model_) : model(model_) {}
+
+  std::string model;
+  std::vector<int64_t> latencies[kOpCount];  // Nanoseconds
+  int64_t total_ns = 0;
+  int64_t ops = 0;
+  int64_t events = 0;
+  // Digest of the events and query results of every record, events fired by
+  // one record are sorted, since models may fire them in different orders
+  std::vector<uint64_t> digests;
+};
+
+uint64_t Mix(uint64_t h, uint64_t value) {
+  h ^= value + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+template <class AOIImpl>
+bool Replay(TraceReader& reader, ReplayResult& result) {
+  const TraceHeader& header = reader.header();
+  // 1 for enter, 2 for leave, 3 and above for tier 0 and above
+  std::vector<std::tuple<int, int, int>> events;
+  auto enter_callback = [&events](int me, int other) {
+    events.emplace_back(1, me, other);
+  };
+  auto leave_callback = [&events](int me, int other) {
+    events.emplace_back(2, me, other);
+  };
+  AOIImpl aoi(header.width, header.height, header.visible_range,
+              enter_callback, leave_callback);
+  aoi.SetPairEvent(header.modes & kTracePairEvent);
+  aoi.SetDeferUpdates(header.modes & kTraceDeferUpdates);
+
+  reader.Rewind();
+  TraceRecord record;
+  std::vector<int> query_ids;
+  while (reader.Next(&record)) {
+    events.clear();
+    query_ids.clear();
+    auto t1 = std::chrono::steady_clock::now();
+    switch (record.op) {
+      case TraceRecord::kAdd:
+        aoi.AddUnit(record.id, record.x, record.y, record.flags, record.range,
+                    record.mask, record.layer);
+        break;
+      case TraceRecord::kUpdate:
+        aoi.UpdateUnit(record.id, record.x, record.y);
+        break;
+      case TraceRecord::kRemove:
+        aoi.RemoveUnit(record.id);
+        break;
+      case TraceRecord::kQuery:
+        for (auto id : aoi.FindNearbyUnit(record.id, record.range)) {
+          query_ids.push_back(id);
+        }
+        break;
+      case TraceRecord::kBeginTick:
+        aoi.BeginTick();
+        break;
+      case TraceRecord::kEndTick:
+        aoi.EndTick();
+        break;
+      case TraceRecord::kSetDeferUpdates:
+        aoi.SetDeferUpdates(record.enabled);
+        break;
+      case TraceRecord::kSetRangeTiers:
+        aoi.SetRangeTiers(record.bounds, [&events](int me, int other,
+                                                   int tier) {
+          events.emplace_back(3 + tier, me, other);
+        });
+        break;
+      case TraceRecord::kSetLargeRange:
+        aoi.SetLargeRange(record.range);
+        break;
+      case TraceRecord::kProcessUpdates: {
+        AOI::UpdateBudget budget;
+        budget.max_units = record.max_units;
+        budget.max_delay = record.max_delay;
+        aoi.ProcessUpdates(budget);
+        break;
+      }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    int64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    result.latencies[record.op].push_back(ns);
+    result.total_ns += ns;
+    ++result.ops;
+    result.events += events.size();
+
+    std::sort(events.begin(), events.end());
+    std::sort(query_ids.begin(), query_ids.end());
+    uint64_t digest = Mix(0, record.op);
+    for (const auto& event : events) {
+      digest = Mix(digest, std::get<0>(event));
+      digest = Mix(digest, static_cast<uint32_t>(std::get<1>(event)));
+      digest = Mix(digest, static_cast<uint32_t>(std::get<2>(event)));
+    }
+    for (auto id : query_ids) {
+      digest = Mix(digest, static_cast<uint32_t>(id));
+    }
+    result.digests.push_back(digest);
+  }
+  // The whole trace must be consumed, otherwise it is truncated or corrupted
+  return result.ops > 0 && reader.AtEnd();
+}
+
+void Report(const ReplayResult& result) {
+  double seconds = result.total_ns / 1e9;
+  printf("[%s] %ld ops, %.3f ms, %.0f ops/s, %ld events, %.0f events/s\n",
+         result.model.c_str(), result.ops, seconds * 1e3,
+         seconds > 0 ? result.ops / seconds : 0, result.events,
+         seconds > 0 ? result.events / seconds : 0);
+  for (int op = 1; op < kOpCount; ++op) {
+    std::vector<int64_t> latencies = result.latencies[op];
+    if (latencies.empty()) {
+      continue;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("  %-10s count=%zu p50=%ldns p99=%ldns p999=%ldns\n", kOpNames[op],
+           latencies.size(), Percentile(latencies, 0.5),
+           Percentile(latencies, 0.99), Percentile(latencies, 0.999));
+  }
+}
+
+int main(int argc, char const* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s TRACE_FILE [all|tower,quadtree,crosslink]\n",
+            argv[0]);
+    return 1;
+  }
+
+  TraceReader reader(argv[1]);
+  if (!reader.IsOpen()) {
+    fprintf(stderr, "Can not open trace %s\n", argv[1]);
+    return 1;
+  }
+  std::string models = argc > 2 ? argv[2] : "all";
+  auto selected = [&models](const std::string& name) {
+    return models == "all" ||
+           ("," + models + ",").find("," + name + ",") != std::string::npos;
+  };
+
+  std::vector<ReplayResult> results;
+  bool ok = true;
+  if (selected("tower")) {
+    results.emplace_back("tower");
+    ok = Replay<TowerAOI>(reader, results.back()) && ok;
+  }
+  if (selected("quadtree")) {
+    results.emplace_back("quadtree");
+    ok = Replay<QuadTreeAOI>(reader, results.back()) && ok;
+  }
+  if (selected("crosslink")) {
+    results.emplace_back("crosslink");
+    ok = Replay<CrosslinkAOI>(reader, results.back()) && ok;
+  }
+  if (!ok) {
+    fprintf(stderr, "Trace %s is empty or corrupted\n", argv[1]);
+    return 1;
+  }
+
+  for (const auto& result : results) {
+    Report(result);
+  }
+
+  // Compare the events of every model with the first one
+  int mismatches = 0;
+  for (size_t i = 1; i < results.size(); ++i) {
+    const auto& digests = results[i].digests;
+    const auto& expected = results[0].digests;
+    auto it = std::mismatch(digests.begin(), digests.end(), expected.begin());
+    if (it.first != digests.end()) {
+      printf("[%s] events differ from [%s] at record %ld\n",
+             results[i].model.c_str(), results[0].model.c_str(),
+             static_cast<long>(it.first - digests.begin()));
+      ++mismatches;
+    }
+  }
+  if (results.size() > 1 && 0 == mismatches) {
+    printf("All models fired identical events\n");
+  }
+  return mismatches > 0 ? 2 : 0;
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <random>
 
@@ -72,6 +74,29 @@ class CrosslinkAOI::SkipList {
     }
   }
 
+  // Insert datas sorted by the comparator into an empty list in linear time,
+  // return the node of each data
+  std::vector<SkipNode*> Build(const std::vector<CrosslinkAOI::Unit*>& datas) {
+    assert(tail_ == head_->nexts[0]);
+    SkipNode* lasts[kMaxLevel];
+    std::fill(lasts, lasts + kMaxLevel, head_);
+    std::vector<SkipNode*> nodes(datas.size());
+    for (size_t i = 0; i < datas.size(); ++i) {
+      SkipNode* new_node = new SkipNode(RandomLevel(), datas[i]);
+      for (int l = 0; l < new_node->level; ++l) {
+        new_node->prevs[l] = lasts[l];
+        lasts[l]->nexts[l] = new_node;
+        lasts[l] = new_node;
+      }
+      nodes[i] = new_node;
+    }
+    for (int l = 0; l < kMaxLevel; ++l) {
+      lasts[l]->nexts[l] = tail_;
+      tail_->prevs[l] = lasts[l];
+    }
+    return nodes;
+  }
+
   void Erase(SkipNode* erase_node) {
     int erase_level = erase_node->level;
     for (int l = 0; l < erase_level; ++l) {
@@ -89,13 +114,22 @@ class CrosslinkAOI::SkipList {
 
   SkipNode* Next(const SkipNode* node) const { return node->nexts[0]; }
 
+  bool Empty() const { return tail_ == head_->nexts[0]; }
+
+  // First node not less than data, or the tail
+  SkipNode* LowerBound(const CrosslinkAOI::Unit* data) const {
+    SkipNode* prevs[kMaxLevel];
+    return Next(FindLastLess(data, prevs));
+  }
+
   SkipNode* Prev(const SkipNode* node) const { return node->prevs[0]; }
 
-  typedef std::function<bool(const Unit* data)> ForeachFunction;
-  void ForeachForward(const SkipNode* begin_node,
-                      const ForeachFunction& func) const;
+  // Call func for the nodes from begin_node on, until it returns false
+  template <class Function>
+  void ForeachForward(const SkipNode* begin_node, const Function& func) const;
+  template <class Function>
   void ForeachBackward(const SkipNode* begin_node,
-                       const ForeachFunction& func) const;
+                       const Function& func) const;
 
   struct SkipNode {
     SkipNode(const int level_)
@@ -185,13 +219,15 @@ class CrosslinkAOI::SkipList {
     }                               \
   } while (0)
 
+template <class Function>
 void CrosslinkAOI::SkipList::ForeachForward(const SkipNode* begin_node,
-                                            const ForeachFunction& func) const {
+                                            const Function& func) const {
   FOR_EACH(nexts, tail_);
 }
 
-void CrosslinkAOI::SkipList::ForeachBackward(
-    const SkipNode* begin_node, const ForeachFunction& func) const {
+template <class Function>
+void CrosslinkAOI::SkipList::ForeachBackward(const SkipNode* begin_node,
+                                             const Function& func) const {
   FOR_EACH(prevs, head_);
 }
 
@@ -214,62 +250,128 @@ void CrosslinkAOI::DeleteUnit(AOI::Unit* unit) {
 CrosslinkAOI::CrosslinkAOI(float width, float height, float visible_range,
                            const AOI::Callback& enter_callback,
                            const AOI::Callback& leave_callback)
-    : AOI(width, height, visible_range, enter_callback, leave_callback),
-      x_list_(new SkipList(ComparatorX())),
-      y_list_(new SkipList(ComparatorY())) {}
-
-CrosslinkAOI::~CrosslinkAOI() {
-  std::vector<UnitID> unit_ids = get_unit_ids();
-  for (auto id : unit_ids) {
-    RemoveUnit(id);
+    : AOI(width, height, visible_range, enter_callback, leave_callback) {}
+
+CrosslinkAOI::~CrosslinkAOI() { Clear(); }
+
+CrosslinkAOI::Layer& CrosslinkAOI::GetLayer(int layer) {
+  auto it = layers_.find(layer);
+  if (it != layers_.end()) {
+    return it->second;
+  }
+
+  Layer& new_layer = layers_[layer];
+  new_layer.x_list = new SkipList(ComparatorX());
+  new_layer.y_list = new SkipList(ComparatorY());
+  return new_layer;
+}
+
+void CrosslinkAOI::BuildIndex(const std::vector<AOI::Unit*>& units) {
+  std::unordered_map<int, std::vector<Unit*>> layer_units;
+  for (auto unit : units) {
+    ValidatePosition(unit->x, unit->y);
+    layer_units[unit->layer].push_back(static_cast<Unit*>(unit));
+  }
+
+  for (auto& pair : layer_units) {
+    Layer& unit_layer = GetLayer(pair.first);
+    std::vector<Unit*>& sorted_units = pair.second;
+    std::sort(sorted_units.begin(), sorted_units.end(), ComparatorX());
+    std::vector<SkipList::SkipNode*> nodes =
+        unit_layer.x_list->Build(sorted_units);
+    for (size_t i = 0; i < sorted_units.size(); ++i) {
+      sorted_units[i]->x_skip_node = nodes[i];
+    }
+
+    std::sort(sorted_units.begin(), sorted_units.end(), ComparatorY());
+    nodes = unit_layer.y_list->Build(sorted_units);
+    for (size_t i = 0; i < sorted_units.size(); ++i) {
+      sorted_units[i]->y_skip_node = nodes[i];
+    }
   }
+}
 
-  delete x_list_;
-  delete y_list_;
+void CrosslinkAOI::ClearIndex() {
+  for (auto& pair : layers_) {
+    delete pair.second.x_list;
+    delete pair.second.y_list;
+  }
+  layers_.clear();
 }
 
-void CrosslinkAOI::AddUnit(UnitID id, float x, float y) {
+void CrosslinkAOI::AddUnit(UnitID id, float x, float y, int flags,
+                           float range, uint32_t mask, int layer) {
+  AOI_STAT(ScopedLatency latency(&stats_.add_latency));
   ValidatetUnitID(id);
   ValidatePosition(x, y);
 
   Unit* unit = static_cast<Unit*>(NewUnit(id, x, y));
-  unit->x_skip_node = x_list_->Insert(unit);
-  unit->y_skip_node = y_list_->Insert(unit);
+  unit->flags = flags;
+  unit->range = range;
+  unit->mask = mask;
+  unit->layer = layer;
+  Layer& unit_layer = GetLayer(layer);
+  unit->x_skip_node = unit_layer.x_list->Insert(unit);
+  unit->y_skip_node = unit_layer.y_list->Insert(unit);
 
   OnAddUnit(unit);
 }
 
 void CrosslinkAOI::UpdateUnit(UnitID id, float x, float y) {
   ValidatePosition(x, y);
+  if (DeferUpdate(id, x, y)) {
+    return;
+  }
+  AOI_STAT(ScopedLatency latency(&stats_.update_latency));
 
   Unit* unit = static_cast<Unit*>(get_unit(id));
   SkipList::SkipNode* x_skip_node = unit->x_skip_node;
   SkipList::SkipNode* y_skip_node = unit->y_skip_node;
-  x_list_->Erase(x_skip_node);
-  y_list_->Erase(y_skip_node);
+  Layer& unit_layer = GetLayer(unit->layer);
+  unit_layer.x_list->Erase(x_skip_node);
+  unit_layer.y_list->Erase(y_skip_node);
   unit->x = x;
   unit->y = y;
-  x_list_->Insert(x_skip_node);
-  y_list_->Insert(y_skip_node);
+  unit_layer.x_list->Insert(x_skip_node);
+  unit_layer.y_list->Insert(y_skip_node);
 
   OnUpdateUnit(unit);
 }
 
 void CrosslinkAOI::RemoveUnit(UnitID id) {
+  AOI_STAT(ScopedLatency latency(&stats_.remove_latency));
   Unit* unit = static_cast<Unit*>(get_unit(id));
 
-  x_list_->EraseAndDelete(unit->x_skip_node);
-  y_list_->EraseAndDelete(unit->y_skip_node);
+  int layer = unit->layer;
+  Layer& unit_layer = GetLayer(layer);
+  unit_layer.x_list->EraseAndDelete(unit->x_skip_node);
+  unit_layer.y_list->EraseAndDelete(unit->y_skip_node);
 
   OnRemoveUnit(unit);
+
+  // Free the skiplists of a layer once its last unit leaves, callbacks may
+  // have added units to it meanwhile
+  auto it = layers_.find(layer);
+  if (it != layers_.end() && it->second.x_list->Empty()) {
+    delete it->second.x_list;
+    delete it->second.y_list;
+    layers_.erase(it);
+  }
 }
 
 AOI::UnitSet CrosslinkAOI::FindNearbyUnit(const AOI::Unit* unit,
                                           float range) const {
+  const SkipList* x_list = layers_.at(unit->layer).x_list;
+  const SkipList* y_list = layers_.at(unit->layer).y_list;
+  AOI_STAT(++stats_.searches);
   AOI::UnitSet x_set;
   auto x_for_func = [&](const Unit* other) {
+    AOI_STAT(++stats_.nodes_visited);
     if (fabs(unit->x - other->x) <= range) {
-      x_set.insert(const_cast<Unit*>(other));
+      AOI_STAT(++stats_.units_scanned);
+      if (0 != (unit->mask & other->mask)) {
+        x_set.insert(const_cast<Unit*>(other));
+      }
       return true;
     }
     return false;
@@ -277,11 +379,12 @@ AOI::UnitSet CrosslinkAOI::FindNearbyUnit(const AOI::Unit* unit,
 
   SkipList::SkipNode* x_skip_node =
       static_cast<Unit*>(const_cast<AOI::Unit*>(unit))->x_skip_node;
-  x_list_->ForeachForward(x_list_->Next(x_skip_node), x_for_func);
-  x_list_->ForeachBackward(x_list_->Prev(x_skip_node), x_for_func);
+  x_list->ForeachForward(x_list->Next(x_skip_node), x_for_func);
+  x_list->ForeachBackward(x_list->Prev(x_skip_node), x_for_func);
 
   AOI::UnitSet res_set;
   auto y_for_func = [&](const Unit* other) {
+    AOI_STAT(++stats_.nodes_visited);
     if (fabs(unit->y - other->y) <= range) {
       if (x_set.find(const_cast<Unit*>(other)) != x_set.end()) {
         res_set.insert(const_cast<Unit*>(other));
@@ -293,7 +396,73 @@ AOI::UnitSet CrosslinkAOI::FindNearbyUnit(const AOI::Unit* unit,
 
   SkipList::SkipNode* y_skip_node =
       static_cast<Unit*>(const_cast<AOI::Unit*>(unit))->y_skip_node;
-  y_list_->ForeachForward(y_list_->Next(y_skip_node), y_for_func);
-  y_list_->ForeachBackward(y_list_->Prev(y_skip_node), y_for_func);
+  y_list->ForeachForward(y_list->Next(y_skip_node), y_for_func);
+  y_list->ForeachBackward(y_list->Prev(y_skip_node), y_for_func);
   return res_set;
 }
+
+template <class Function>
+void CrosslinkAOI::ForeachInBox(int layer, float x1, float y1, float x2,
+                                float y2, const Function& func) const {
+  auto it = layers_.find(layer);
+  if (it == layers_.end()) {
+    return;
+  }
+
+  // Walk the window of the axis on which the box is narrower, from the
+  // first unit past its lower bound, and check the other axis inline
+  bool along_x = x2 - x1 <= y2 - y1;
+  const SkipList* list = along_x ? it->second.x_list : it->second.y_list;
+  Unit probe(INT_MIN, x1, y1);
+  AOI_STAT(++stats_.searches);
+  list->ForeachForward(list->LowerBound(&probe), [&](const Unit* other) {
+    AOI_STAT(++stats_.nodes_visited);
+    if ((along_x ? other->x : other->y) > (along_x ? x2 : y2)) {
+      return false;
+    }
+    AOI_STAT(++stats_.units_scanned);
+    if (other->x >= x1 && other->x <= x2 && other->y >= y1 &&
+        other->y <= y2) {
+      func(other);
+    }
+    return true;
+  });
+}
+
+void CrosslinkAOI::CollectInShape(const AOIShape& shape, int layer,
+                                  uint32_t mask,
+                                  ShapeCandidates* candidates) const {
+  float x1, y1, x2, y2;
+  shape.GetBounds(&x1, &y1, &x2, &y2);
+  ForeachInBox(layer, x1, y1, x2, y2, [mask, candidates](const Unit* other) {
+    if (0 != (mask & other->mask)) {
+      candidates->Push(other);
+    }
+  });
+}
+
+size_t CrosslinkAOI::CountInBox(float x1, float y1, float x2, float y2,
+                                int layer) const {
+  size_t count = 0;
+  ForeachInBox(layer, x1, y1, x2, y2, [&count](const Unit*) { ++count; });
+  return count;
+}
+
+void CrosslinkAOI::FillDensityGrid(const GridLayout& grid, int layer,
+                                   uint32_t* counts) const {
+  auto it = layers_.find(layer);
+  if (it == layers_.end()) {
+    return;
+  }
+
+  // Walk the x list of the layer, which holds only its units, instead of
+  // all units of the map
+  const SkipList* list = it->second.x_list;
+  Unit probe(INT_MIN, -HUGE_VALF, 0);
+  AOI_STAT(++stats_.searches);
+  list->ForeachForward(list->LowerBound(&probe), [&](const Unit* other) {
+    AOI_STAT(++stats_.nodes_visited);
+    ++counts[grid.Index(grid.Row(other->y), grid.Col(other->x))];
+    return true;
+  });
+}
@@ -9,6 +9,11 @@ class CrosslinkAOI : public AOI {
   class SkipList;
   struct Unit;
 
+  struct Layer {
+    SkipList* x_list;
+    SkipList* y_list;
+  };
+
  public:
   CrosslinkAOI(float width, float height, float visible_range,
                const AOI::Callback& enter_callback,
@@ -16,19 +21,34 @@ class CrosslinkAOI : public AOI {
 
   ~CrosslinkAOI() override;
 
-  void AddUnit(UnitID id, float x, float y) override;
+  using AOI::AddUnit;
+  void AddUnit(UnitID id, float x, float y, int flags, float range,
+               uint32_t mask, int layer) override;
   void UpdateUnit(UnitID id, float x, float y) override;
   void RemoveUnit(UnitID id) override;
+  using AOI::FindNearbyUnit;
 
  protected:
   AOI::UnitSet FindNearbyUnit(const AOI::Unit* unit,
                               float range) const override;
+  void CollectInShape(const AOIShape& shape, int layer, uint32_t mask,
+                      ShapeCandidates* candidates) const override;
+  size_t CountInBox(float x1, float y1, float x2, float y2,
+                    int layer) const override;
+  void FillDensityGrid(const GridLayout& grid, int layer,
+                       uint32_t* counts) const override;
 
  private:
   AOI::Unit* NewUnit(UnitID id, float x, float y) override;
   void DeleteUnit(AOI::Unit* unit) override;
-
-  SkipList* x_list_;
-  SkipList* y_list_;
+  void BuildIndex(const std::vector<AOI::Unit*>& units) override;
+  void ClearIndex() override;
+  Layer& GetLayer(int layer);
+  // Call func for the units of layer in the box
+  template <class Function>
+  void ForeachInBox(int layer, float x1, float y1, float x2, float y2,
+                    const Function& func) const;
+
+  std::unordered_map<int, Layer> layers_;  // Skiplists of each layer
 };
 #endif  // CROSSLINK_AOI_H
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstring>
+#include <queue>
 
 #include "quadtree_aoi/quadtree_aoi.h"
 
@@ -25,9 +27,26 @@ class QuadTreeAOI::QuadTree {
       return x >= x1 && x <= x2 && y >= y1 && y <= y2;
     }
 
+    bool Contains(const Box& other) const {
+      return other.x1 >= x1 && other.x2 <= x2 && other.y1 >= y1 &&
+             other.y2 <= y2;
+    }
+
     bool Intersects(const Box& other) const {
-      return std::max(x1, other.x1) < std::min(x2, other.x2) &&
-             std::max(y1, other.y1) < std::min(y2, other.y2);
+      return std::max(x1, other.x1) <= std::min(x2, other.x2) &&
+             std::max(y1, other.y1) <= std::min(y2, other.y2);
+    }
+
+    // Whether the box may overlap shape
+    bool Intersects(const AOIShape& shape) const {
+      return shape.Intersects(x1, y1, x2, y2);
+    }
+
+    // Squared distance from (x, y) to the nearest point of the box
+    float DistanceSquare(float x, float y) const {
+      float dx = std::max(std::max(x1 - x, x - x2), 0.0f);
+      float dy = std::max(std::max(y1 - y, y - y2), 0.0f);
+      return dx * dx + dy * dy;
     }
   };
 
@@ -37,14 +56,48 @@ class QuadTreeAOI::QuadTree {
 
   void Insert(Unit* unit) { return Insert(root_, unit); };
 
-  AOI::UnitSet Search(const Box& box) const {
+  // Insert units into an empty tree top down, the tree is the same as if
+  // they were inserted one by one
+  void Build(std::vector<Unit*>& units) {
+    assert(root_->leaf && root_->Empty());
+    Build(root_, units.data(), units.data() + units.size());
+  }
+
+  // Push units which match mask into heap, visiting the nodes nearest to
+  // (x, y) first until the next node is farther than the k-th unit found
+  void FindKNearest(float x, float y, uint32_t mask, const AOI::Unit* exclude,
+                    NearestHeap& heap, AOIStats* stats) const;
+
+  // Unlink all units, so that the tree can be deleted without them
+  void DetachUnits() { DetachUnits(root_); }
+
+  // Search units in box which match the given mask
+  AOI::UnitSet Search(const Box& box, uint32_t mask, AOIStats* stats) const {
     AOI::UnitSet unit_set;
-    Search(root_, box, unit_set);
+    Search(root_, box, mask, unit_set, stats);
     return unit_set;
   };
 
+  // Push units which match mask and may be inside shape into candidates
+  void Search(const AOIShape& shape, uint32_t mask,
+              ShapeCandidates* candidates, AOIStats* stats) const {
+    Search(root_, shape, mask, candidates, stats);
+  }
+
+  // Count units in box, whatever their mask
+  size_t Count(const Box& box, AOIStats* stats) const {
+    return Count(root_, box, stats);
+  }
+
+  // Add units to the counts of their cells
+  void FillDensityGrid(const GridLayout& grid, uint32_t* counts) const {
+    FillDensityGrid(root_, grid, counts);
+  }
+
   void Delete(Unit* unit);
 
+  bool Empty() const { return 0 == root_->count; }
+
   struct QuadTreeNode {
     QuadTreeNode(int depth_, Box box_, QuadTreeNode* parent_);
     ~QuadTreeNode();
@@ -67,6 +120,7 @@ class QuadTreeAOI::QuadTree {
     }
 
     int depth;
+    int count;  // Units in the subtree
     bool leaf;
     Box const box;
     Unit* head;
@@ -77,8 +131,17 @@ class QuadTreeAOI::QuadTree {
 
  private:
   void Insert(QuadTreeNode* node, Unit* unit);
-  void Search(const QuadTreeNode* node, const Box& box,
-              AOI::UnitSet& unit_set) const;
+  void Split(QuadTreeNode* node);
+  void Build(QuadTreeNode* node, Unit** begin, Unit** end);
+  void DetachUnits(QuadTreeNode* node);
+  void Search(const QuadTreeNode* node, const Box& box, uint32_t mask,
+              AOI::UnitSet& unit_set, AOIStats* stats) const;
+  void Search(const QuadTreeNode* node, const AOIShape& shape, uint32_t mask,
+              ShapeCandidates* candidates, AOIStats* stats) const;
+  size_t Count(const QuadTreeNode* node, const Box& box,
+               AOIStats* stats) const;
+  void FillDensityGrid(const QuadTreeNode* node, const GridLayout& grid,
+                       uint32_t* counts) const;
   void Destruct(QuadTreeNode* node) {
     if (nullptr == node) {
       return;
@@ -112,6 +175,7 @@ struct QuadTreeAOI::Unit : AOI::Unit {
 QuadTreeAOI::QuadTree::QuadTreeNode::QuadTreeNode(int depth_, Box box_,
                                                   QuadTreeNode* parent_)
     : depth(depth_),
+      count(0),
       leaf(true),
       box(box_),
       head(new Unit(0, 0, 0)),
@@ -146,6 +210,7 @@ void QuadTreeAOI::QuadTree::QuadTreeNode::Delete(Unit* delete_unit) {
 bool QuadTreeAOI::QuadTree::QuadTreeNode::Empty() { return head->next == tail; }
 
 void QuadTreeAOI::QuadTree::Insert(QuadTreeNode* node, Unit* unit) {
+  ++node->count;
   if (node->leaf) {
     if (node->Empty() || node->depth >= kMaxDegree) {
       // Have no units
@@ -153,24 +218,12 @@ void QuadTreeAOI::QuadTree::Insert(QuadTreeNode* node, Unit* unit) {
       unit->quad_tree_node = node;
       return;
     } else {
-      // Split current node
-      const Box& box = node->box;
-      float mid_x = (box.x1 + box.x2) / 2;
-      float mid_y = (box.y1 + box.y2) / 2;
-      node->top_left() = new QuadTreeNode(
-          node->depth + 1, Box(box.x1, mid_y, mid_x, box.y2), node);
-      node->top_right() = new QuadTreeNode(
-          node->depth + 1, Box(mid_x, mid_y, box.x2, box.y2), node);
-      node->bottom_left() = new QuadTreeNode(
-          node->depth + 1, Box(box.x1, box.y1, mid_x, mid_y), node);
-      node->bottom_right() = new QuadTreeNode(
-          node->depth + 1, Box(mid_x, box.y1, box.x2, mid_y), node);
-      node->leaf = false;
-
+      Split(node);
       Unit* p = node->head->next;
       while (p != node->tail) {
         Unit* temp = p->next;
         node->Delete(p);
+        --node->count;  // Counted again by Insert
         Insert(node, p);
         p = temp;
       }
@@ -186,22 +239,114 @@ void QuadTreeAOI::QuadTree::Insert(QuadTreeNode* node, Unit* unit) {
   });
 }
 
+void QuadTreeAOI::QuadTree::Split(QuadTreeNode* node) {
+  const Box& box = node->box;
+  float mid_x = (box.x1 + box.x2) / 2;
+  float mid_y = (box.y1 + box.y2) / 2;
+  node->top_left() = new QuadTreeNode(
+      node->depth + 1, Box(box.x1, mid_y, mid_x, box.y2), node);
+  node->top_right() = new QuadTreeNode(
+      node->depth + 1, Box(mid_x, mid_y, box.x2, box.y2), node);
+  node->bottom_left() = new QuadTreeNode(
+      node->depth + 1, Box(box.x1, box.y1, mid_x, mid_y), node);
+  node->bottom_right() = new QuadTreeNode(
+      node->depth + 1, Box(mid_x, box.y1, box.x2, mid_y), node);
+  node->leaf = false;
+}
+
+void QuadTreeAOI::QuadTree::Build(QuadTreeNode* node, Unit** begin,
+                                  Unit** end) {
+  node->count = static_cast<int>(end - begin);
+  if (end - begin <= 1 || node->depth >= kMaxDegree) {
+    for (Unit** p = begin; p != end; ++p) {
+      node->Insert(*p);
+      (*p)->quad_tree_node = node;
+    }
+    return;
+  }
+
+  // Like Insert, a unit goes to the first child which contains it
+  Split(node);
+  node->Foreach([this, &begin, end](QuadTreeNode* child_node) {
+    Unit** child_end = std::partition(begin, end, [child_node](Unit* unit) {
+      return child_node->box.Contains(unit->x, unit->y);
+    });
+    Build(child_node, begin, child_end);
+    begin = child_end;
+    return true;
+  });
+  assert(begin == end);
+}
+
+void QuadTreeAOI::QuadTree::FindKNearest(float x, float y, uint32_t mask,
+                                         const AOI::Unit* exclude,
+                                         NearestHeap& heap,
+                                         AOIStats* stats) const {
+  (void)stats;  // Only used with AOI_STATS
+  typedef std::pair<float, QuadTreeNode*> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  queue.push(Entry(root_->box.DistanceSquare(x, y), root_));
+  while (!queue.empty() && queue.top().first <= heap.bound()) {
+    QuadTreeNode* node = queue.top().second;
+    queue.pop();
+    AOI_STAT(++stats->nodes_visited);
+
+    if (!node->leaf) {
+      node->Foreach([x, y, &heap, &queue](QuadTreeNode* child_node) {
+        float distance_sq = child_node->box.DistanceSquare(x, y);
+        if (distance_sq <= heap.bound()) {
+          queue.push(Entry(distance_sq, child_node));
+        }
+        return true;
+      });
+      continue;
+    }
+
+    for (Unit* p = node->head->next; p != node->tail; p = p->next) {
+      AOI_STAT(++stats->units_scanned);
+      if (p != exclude && 0 != (p->mask & mask)) {
+        float dx = p->x - x;
+        float dy = p->y - y;
+        heap.Push(p, dx * dx + dy * dy);
+      }
+    }
+  }
+}
+
+void QuadTreeAOI::QuadTree::DetachUnits(QuadTreeNode* node) {
+  if (nullptr == node) {
+    return;
+  }
+
+  node->head->next = node->tail;
+  node->tail->prev = node->head;
+  node->Foreach([this](QuadTreeNode* child_node) {
+    DetachUnits(child_node);
+    return true;
+  });
+}
+
 void QuadTreeAOI::QuadTree::Delete(Unit* unit) {
   QuadTreeNode* node = unit->quad_tree_node;
   node->Delete(unit);
   unit->quad_tree_node = nullptr;
+  for (; nullptr != node; node = node->parent) {
+    --node->count;
+  }
 }
 
 void QuadTreeAOI::QuadTree::Search(const QuadTreeNode* node, const Box& box,
-                                   AOI::UnitSet& unit_set) const {
+                                   uint32_t mask, AOI::UnitSet& unit_set,
+                                   AOIStats* stats) const {
+  AOI_STAT(++stats->nodes_visited);
   if (!node->box.Intersects(box)) {
     return;
   }
 
   if (!node->leaf) {
     const_cast<QuadTreeNode*>(node)->Foreach(
-        [this, &box, &unit_set](QuadTreeNode* child_node) {
-          Search(child_node, box, unit_set);
+        [this, &box, mask, &unit_set, stats](QuadTreeNode* child_node) {
+          Search(child_node, box, mask, unit_set, stats);
           return true;
         });
     return;
@@ -209,55 +354,153 @@ void QuadTreeAOI::QuadTree::Search(const QuadTreeNode* node, const Box& box,
 
   Unit* p = node->head->next;
   while (p != node->tail) {
-    if (box.Contains(p->x, p->y)) {
+    AOI_STAT(++stats->units_scanned);
+    if (0 != (p->mask & mask) && box.Contains(p->x, p->y)) {
       unit_set.insert(p);
     }
     p = p->next;
   }
 }
 
-QuadTreeAOI::QuadTreeAOI(float width, float height, float visible_range,
-                         const AOI::Callback& enter_callback,
-                         const AOI::Callback& leave_callback)
-    : AOI(width, height, visible_range, enter_callback, leave_callback),
-      quad_tree_(new QuadTree(width, height)) {}
+void QuadTreeAOI::QuadTree::Search(const QuadTreeNode* node,
+                                   const AOIShape& shape, uint32_t mask,
+                                   ShapeCandidates* candidates,
+                                   AOIStats* stats) const {
+  AOI_STAT(++stats->nodes_visited);
+  if (!node->box.Intersects(shape)) {
+    return;
+  }
+
+  if (!node->leaf) {
+    const_cast<QuadTreeNode*>(node)->Foreach(
+        [this, &shape, mask, candidates, stats](QuadTreeNode* child_node) {
+          Search(child_node, shape, mask, candidates, stats);
+          return true;
+        });
+    return;
+  }
+
+  for (Unit* p = node->head->next; p != node->tail; p = p->next) {
+    AOI_STAT(++stats->units_scanned);
+    if (0 != (p->mask & mask)) {
+      candidates->Push(p);
+    }
+  }
+}
 
-QuadTreeAOI::~QuadTreeAOI() {
-  std::vector<UnitID> unit_ids = get_unit_ids();
-  for (auto id : unit_ids) {
-    RemoveUnit(id);
+size_t QuadTreeAOI::QuadTree::Count(const QuadTreeNode* node, const Box& box,
+                                    AOIStats* stats) const {
+  AOI_STAT(++stats->nodes_visited);
+  if (0 == node->count || !node->box.Intersects(box)) {
+    return 0;
+  }
+  if (box.Contains(node->box)) {
+    return node->count;
+  }
+
+  size_t count = 0;
+  if (!node->leaf) {
+    const_cast<QuadTreeNode*>(node)->Foreach(
+        [this, &box, &count, stats](QuadTreeNode* child_node) {
+          count += Count(child_node, box, stats);
+          return true;
+        });
+    return count;
   }
 
-  delete quad_tree_;
+  for (Unit* p = node->head->next; p != node->tail; p = p->next) {
+    AOI_STAT(++stats->units_scanned);
+    count += box.Contains(p->x, p->y);
+  }
+  return count;
 }
 
-void QuadTreeAOI::AddUnit(UnitID id, float x, float y) {
+void QuadTreeAOI::QuadTree::FillDensityGrid(const QuadTreeNode* node,
+                                            const GridLayout& grid,
+                                            uint32_t* counts) const {
+  if (0 == node->count) {
+    return;
+  }
+  // Nodes whose closed box lies in one cell are counted as a whole. Units on
+  // the edge between two cells belong to the upper one, so a box which ends
+  // on a cell edge is split
+  const Box& box = node->box;
+  int row = grid.Row(box.y1);
+  int col = grid.Col(box.x1);
+  if (row == grid.Row(box.y2) && col == grid.Col(box.x2)) {
+    counts[grid.Index(row, col)] += node->count;
+    return;
+  }
+
+  if (!node->leaf) {
+    const_cast<QuadTreeNode*>(node)->Foreach(
+        [this, &grid, counts](QuadTreeNode* child_node) {
+          FillDensityGrid(child_node, grid, counts);
+          return true;
+        });
+    return;
+  }
+
+  for (Unit* p = node->head->next; p != node->tail; p = p->next) {
+    ++counts[grid.Index(grid.Row(p->y), grid.Col(p->x))];
+  }
+}
+
+QuadTreeAOI::QuadTreeAOI(float width, float height, float visible_range,
+                         const AOI::Callback& enter_callback,
+                         const AOI::Callback& leave_callback)
+    : AOI(width, height, visible_range, enter_callback, leave_callback) {}
+
+QuadTreeAOI::~QuadTreeAOI() { Clear(); }
+
+void QuadTreeAOI::AddUnit(UnitID id, float x, float y, int flags,
+                          float range, uint32_t mask, int layer) {
+  AOI_STAT(ScopedLatency latency(&stats_.add_latency));
   ValidatetUnitID(id);
   ValidatePosition(x, y);
 
   Unit* unit = static_cast<Unit*>(NewUnit(id, x, y));
-  quad_tree_->Insert(unit);
+  unit->flags = flags;
+  unit->range = range;
+  unit->mask = mask;
+  unit->layer = layer;
+  GetQuadTree(layer)->Insert(unit);
 
   OnAddUnit(unit);
 }
 
 void QuadTreeAOI::UpdateUnit(UnitID id, float x, float y) {
   ValidatePosition(x, y);
+  if (DeferUpdate(id, x, y)) {
+    return;
+  }
+  AOI_STAT(ScopedLatency latency(&stats_.update_latency));
 
   Unit* unit = static_cast<Unit*>(get_unit(id));
-  quad_tree_->Delete(unit);
+  QuadTree* quad_tree = GetQuadTree(unit->layer);
+  quad_tree->Delete(unit);
   unit->x = x;
   unit->y = y;
-  quad_tree_->Insert(unit);
+  quad_tree->Insert(unit);
 
   OnUpdateUnit(unit);
 }
 
 void QuadTreeAOI::RemoveUnit(UnitID id) {
+  AOI_STAT(ScopedLatency latency(&stats_.remove_latency));
   Unit* unit = static_cast<Unit*>(get_unit(id));
-  quad_tree_->Delete(unit);
+  int layer = unit->layer;
+  GetQuadTree(layer)->Delete(unit);
 
   OnRemoveUnit(unit);
+
+  // Free the tree of a layer once its last unit leaves, callbacks may have
+  // added units to it meanwhile
+  auto it = quad_trees_.find(layer);
+  if (it != quad_trees_.end() && it->second->Empty()) {
+    delete it->second;
+    quad_trees_.erase(it);
+  }
 }
 
 AOI::UnitSet QuadTreeAOI::FindNearbyUnit(const AOI::Unit* unit,
@@ -267,11 +510,103 @@ AOI::UnitSet QuadTreeAOI::FindNearbyUnit(const AOI::Unit* unit,
   QuadTree::Box box(
       std::max(unit->x - range, 0.0f), std::max(unit->y - range, 0.0f),
       std::min(unit->x + range, width), std::min(unit->y + range, height));
-  UnitSet unit_set = quad_tree_->Search(box);
+  AOIStats* stats = nullptr;
+  AOI_STAT(stats = &stats_; ++stats_.searches);
+  UnitSet unit_set =
+      quad_trees_.at(unit->layer)->Search(box, unit->mask, stats);
   unit_set.erase(const_cast<AOI::Unit*>(unit));
   return unit_set;
 }
 
+size_t QuadTreeAOI::FindKNearest(UnitID id, size_t k, float max_range,
+                                 Neighbor* result) const {
+  const AOI::Unit* unit = get_unit(id);
+  NearestHeap heap(k, max_range);
+  FindKNearest(unit->x, unit->y, unit->layer, unit->mask, unit, heap);
+  return heap.Output(result);
+}
+
+size_t QuadTreeAOI::FindKNearest(float x, float y, int layer, uint32_t mask,
+                                 size_t k, float max_range,
+                                 Neighbor* result) const {
+  NearestHeap heap(k, max_range);
+  FindKNearest(x, y, layer, mask, nullptr, heap);
+  return heap.Output(result);
+}
+
+void QuadTreeAOI::FindKNearest(float x, float y, int layer, uint32_t mask,
+                               const AOI::Unit* exclude,
+                               NearestHeap& heap) const {
+  auto it = quad_trees_.find(layer);
+  if (it == quad_trees_.end()) {
+    return;
+  }
+  AOIStats* stats = nullptr;
+  AOI_STAT(stats = &stats_; ++stats_.searches);
+  it->second->FindKNearest(x, y, mask, exclude, heap, stats);
+}
+
+void QuadTreeAOI::CollectInShape(const AOIShape& shape, int layer,
+                                 uint32_t mask,
+                                 ShapeCandidates* candidates) const {
+  auto it = quad_trees_.find(layer);
+  if (it == quad_trees_.end()) {
+    return;
+  }
+  AOIStats* stats = nullptr;
+  AOI_STAT(stats = &stats_; ++stats_.searches);
+  it->second->Search(shape, mask, candidates, stats);
+}
+
+size_t QuadTreeAOI::CountInBox(float x1, float y1, float x2, float y2,
+                               int layer) const {
+  auto it = quad_trees_.find(layer);
+  if (it == quad_trees_.end()) {
+    return 0;
+  }
+  AOIStats* stats = nullptr;
+  AOI_STAT(stats = &stats_; ++stats_.searches);
+  return it->second->Count(QuadTree::Box(x1, y1, x2, y2), stats);
+}
+
+void QuadTreeAOI::FillDensityGrid(const GridLayout& grid, int layer,
+                                  uint32_t* counts) const {
+  auto it = quad_trees_.find(layer);
+  if (it != quad_trees_.end()) {
+    it->second->FillDensityGrid(grid, counts);
+  }
+}
+
+void QuadTreeAOI::BuildIndex(const std::vector<AOI::Unit*>& units) {
+  std::unordered_map<int, std::vector<Unit*>> layer_units;
+  for (auto unit : units) {
+    ValidatePosition(unit->x, unit->y);
+    layer_units[unit->layer].push_back(static_cast<Unit*>(unit));
+  }
+  for (auto& pair : layer_units) {
+    GetQuadTree(pair.first)->Build(pair.second);
+  }
+}
+
+void QuadTreeAOI::ClearIndex() {
+  for (auto& pair : quad_trees_) {
+    pair.second->DetachUnits();
+    delete pair.second;
+  }
+  quad_trees_.clear();
+}
+
+QuadTreeAOI::QuadTree* QuadTreeAOI::GetQuadTree(int layer) {
+  auto it = quad_trees_.find(layer);
+  if (it != quad_trees_.end()) {
+    return it->second;
+  }
+
+  QuadTree* quad_tree = new QuadTree(get_width(), get_height());
+  quad_trees_.insert(std::pair(layer, quad_tree));
+  return quad_tree;
+}
+
 AOI::Unit* QuadTreeAOI::NewUnit(UnitID id, float x, float y) {
   return new Unit(id, x, y);
 }
@@ -15,18 +15,42 @@ class QuadTreeAOI : public AOI {
               const AOI::Callback& leave_callback);
   ~QuadTreeAOI() override;
 
-  void AddUnit(UnitID id, float x, float y) override;
+  using AOI::AddUnit;
+  void AddUnit(UnitID id, float x, float y, int flags, float range,
+               uint32_t mask, int layer) override;
   void UpdateUnit(UnitID id, float x, float y) override;
   void RemoveUnit(UnitID id) override;
+  using AOI::FindNearbyUnit;
+
+  // Find at most k units nearest to id within Euclidean max_range, which are
+  // in the same layer and match its mask, excluding id itself. They are
+  // written into result sorted by distance, and their count is returned
+  size_t FindKNearest(UnitID id, size_t k, float max_range,
+                      Neighbor* result) const;
+
+  // Find at most k units of layer which match mask nearest to (x, y)
+  size_t FindKNearest(float x, float y, int layer, uint32_t mask, size_t k,
+                      float max_range, Neighbor* result) const;
 
  protected:
   AOI::UnitSet FindNearbyUnit(const AOI::Unit* unit,
                               float range) const override;
+  void CollectInShape(const AOIShape& shape, int layer, uint32_t mask,
+                      ShapeCandidates* candidates) const override;
+  size_t CountInBox(float x1, float y1, float x2, float y2,
+                    int layer) const override;
+  void FillDensityGrid(const GridLayout& grid, int layer,
+                       uint32_t* counts) const override;
 
  private:
   AOI::Unit* NewUnit(UnitID id, float x, float y) override;
   void DeleteUnit(AOI::Unit* unit) override;
+  void BuildIndex(const std::vector<AOI::Unit*>& units) override;
+  void ClearIndex() override;
+  void FindKNearest(float x, float y, int layer, uint32_t mask,
+                    const AOI::Unit* exclude, NearestHeap& heap) const;
+  QuadTree* GetQuadTree(int layer);
 
-  QuadTree* quad_tree_;
+  std::unordered_map<int, QuadTree*> quad_trees_;  // Quad tree of each layer
 };
 #endif  // QUADTREE_AOI_H
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+#include "snapshot/snapshot.h"
+
+static bool WriteAll(FILE* fp, const void* data, size_t size) {
+  return 0 == size || fwrite(data, size, 1, fp) == 1;
+}
+
+// Flush the directory entry of path, so that a rename into it is durable
+static bool SyncDirectory(const char* path) {
+  const char* slash = strrchr(path, '/');
+  std::string dir = ".";
+  if (nullptr != slash) {
+    dir = slash == path ? "/" : std::string(path, slash - path);
+  }
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = 0 == fsync(fd);
+  close(fd);
+  return ok;
+}
+
+bool AOISnapshot::Save(const AOI& aoi, const char* path) {
+  assert(!aoi.in_tick_);
+
+  // Units are numbered by their order in the file. They are sorted by
+  // layer, row of visible range and x, so that related units are close to
+  // each other in the file and in memory once restored
+  std::vector<const AOI::Unit*> sorted_units;
+  sorted_units.reserve(aoi.unit_map_.size());
+  for (const auto& pair : aoi.unit_map_) {
+    sorted_units.push_back(pair.second);
+  }
+  float visible_range = aoi.visible_range_ > 0 ? aoi.visible_range_ : 1;
+  auto row = [visible_range](const AOI::Unit* unit) {
+    return floor(unit->y / visible_range);
+  };
+  std::sort(sorted_units.begin(), sorted_units.end(),
+            [&row](const AOI::Unit* a, const AOI::Unit* b) {
+              if (a->layer != b->layer) {
+                return a->layer < b->layer;
+              }
+              float row_a = row(a);
+              float row_b = row(b);
+              return row_a != row_b ? row_a < row_b : a->x < b->x;
+            });
+
+  std::vector<AOI::BulkUnit> units;
+  units.reserve(sorted_units.size());
+  std::unordered_map<const AOI::Unit*, uint32_t> indices;
+  indices.reserve(sorted_units.size());
+  for (const AOI::Unit* unit : sorted_units) {
+    indices.insert(std::pair(unit, static_cast<uint32_t>(units.size())));
+    units.emplace_back(unit->id, unit->x, unit->y, unit->flags, unit->range,
+                       unit->mask, unit->layer);
+  }
+
+  std::vector<SnapshotRelation> relations;
+  if (aoi.pair_event_) {
+    relations.reserve(aoi.edge_map_.size());
+    for (const auto& pair : aoi.edge_map_) {
+      const AOI::Edge& edge = pair.second;
+      uint32_t index = indices[edge.units[0]];
+      uint32_t other_index = indices[edge.units[1]];
+      relations.push_back({std::min(index, other_index),
+                           std::max(index, other_index),
+                           AOI::kSubscribe | AOI::kObserved});
+    }
+  } else {
+    for (uint32_t index = 0; index < sorted_units.size(); ++index) {
+      const AOI::Unit* unit = sorted_units[index];
+      for (const auto& relation : unit->relation_map) {
+        uint32_t other_index = indices[relation.first];
+        if (index < other_index) {
+          relations.push_back({index, other_index,
+                               relation.second & AOI::kRelationMask});
+        }
+      }
+    }
+  }
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.width = aoi.width_;
+  header.height = aoi.height_;
+  header.visible_range = aoi.visible_range_;
+  header.pair_event = aoi.pair_event_;
+  header.unit_count = units.size();
+  header.units_offset = sizeof(header);
+  header.relation_count = relations.size();
+  header.relations_offset =
+      header.units_offset + units.size() * sizeof(AOI::BulkUnit);
+
+  std::string temp_path = std::string(path) + ".tmp";
+  FILE* fp = fopen(temp_path.c_str(), "wb");
+  if (nullptr == fp) {
+    return false;
+  }
+  bool ok = WriteAll(fp, &header, sizeof(header)) &&
+            WriteAll(fp, units.data(), units.size() * sizeof(units[0])) &&
+            WriteAll(fp, relations.data(),
+                     relations.size() * sizeof(relations[0])) &&
+            0 == fflush(fp) && 0 == fsync(fileno(fp));
+  ok = 0 == fclose(fp) && ok;
+  if (!ok || 0 != rename(temp_path.c_str(), path)) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return SyncDirectory(path);
+}
+
+// Set the fields of unit as LoadUnits would from bulk_unit
+static void ToUnit(const AOI& aoi, const AOI::BulkUnit& bulk_unit,
+                   AOI::Unit* unit) {
+  unit->id = bulk_unit.id;
+  unit->x = bulk_unit.x;
+  unit->y = bulk_unit.y;
+  unit->flags = bulk_unit.flags;
+  unit->range =
+      bulk_unit.range < 0 ? aoi.get_visible_range() : bulk_unit.range;
+  unit->mask = bulk_unit.mask;
+  unit->layer = bulk_unit.layer;
+}
+
+// Whether count items of size at offset lie within a file of file_size
+static bool InFile(uint64_t offset, uint64_t count, size_t size,
+                   size_t file_size) {
+  return offset % 4 == 0 && offset <= file_size &&
+         count <= (file_size - offset) / size;
+}
+
+bool AOISnapshot::Load(const char* path, AOI* aoi) {
+  if (!aoi->unit_map_.empty() || aoi->in_tick_) {
+    return false;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == data) {
+    return false;
+  }
+  madvise(data, size, MADV_WILLNEED);
+
+  const uint8_t* base = static_cast<const uint8_t*>(data);
+  const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(base);
+  bool ok =
+      memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0 &&
+      header.version == kSnapshotVersion && header.width == aoi->width_ &&
+      header.height == aoi->height_ &&
+      header.visible_range == aoi->visible_range_ &&
+      static_cast<bool>(header.pair_event) == aoi->pair_event_ &&
+      header.unit_count <= UINT32_MAX &&
+      InFile(header.units_offset, header.unit_count, sizeof(AOI::BulkUnit),
+             size) &&
+      InFile(header.relations_offset, header.relation_count,
+             sizeof(SnapshotRelation), size);
+
+  const AOI::BulkUnit* units =
+      reinterpret_cast<const AOI::BulkUnit*>(base + header.units_offset);
+  const SnapshotRelation* relations =
+      reinterpret_cast<const SnapshotRelation*>(base +
+                                                header.relations_offset);
+  // Check every unit and relation before touching aoi, a corrupted file must
+  // not break the invariants of the models
+  std::unordered_set<AOI::UnitID> ids;
+  ids.reserve(ok ? header.unit_count : 0);
+  for (uint64_t i = 0; ok && i < header.unit_count; ++i) {
+    const AOI::BulkUnit& unit = units[i];
+    // Negative ranges stand for the default one and infinite ranges for
+    // broadcast watchers, only NaN is not a range
+    ok = ids.insert(unit.id).second && aoi->IsValidPosition(unit.x, unit.y) &&
+         !std::isnan(unit.range) &&
+         0 == (unit.flags & ~(AOI::kWatcher | AOI::kMarker));
+    if (ok && aoi->pair_event_) {
+      ok = unit.flags == (AOI::kWatcher | AOI::kMarker) &&
+           (unit.range < 0 || unit.range == aoi->visible_range_);
+    }
+  }
+
+  // Relations must be stored once per pair and be those the units have,
+  // the relations of each unit are counted to size their maps once
+  std::vector<uint32_t> degrees(ok ? header.unit_count : 0);
+  std::unordered_set<uint64_t> pairs;
+  pairs.reserve(ok ? header.relation_count : 0);
+  AOI::Unit unit(0, 0, 0);
+  AOI::Unit other(0, 0, 0);
+  for (uint64_t i = 0; ok && i < header.relation_count; ++i) {
+    const SnapshotRelation& relation = relations[i];
+    ok = relation.unit < relation.other &&
+         relation.other < header.unit_count &&
+         pairs.insert(uint64_t(relation.unit) << 32 | relation.other).second;
+    if (ok) {
+      ToUnit(*aoi, units[relation.unit], &unit);
+      ToUnit(*aoi, units[relation.other], &other);
+      ok = relation.relation == aoi->GetRelation(&unit, &other) &&
+           (!aoi->pair_event_ ||
+            relation.relation == (AOI::kSubscribe | AOI::kObserved));
+    }
+    if (ok) {
+      ++degrees[relation.unit];
+      ++degrees[relation.other];
+    }
+  }
+  if (!ok) {
+    munmap(data, size);
+    return false;
+  }
+
+  std::vector<AOI::Unit*> new_units =
+      aoi->LoadUnits(units, header.unit_count);
+  if (aoi->pair_event_) {
+    aoi->edge_map_.reserve(header.relation_count);
+    for (uint64_t i = 0; i < header.relation_count; ++i) {
+      aoi->LinkEdge(new_units[relations[i].unit],
+                    new_units[relations[i].other]);
+    }
+  } else {
+    for (size_t i = 0; i < new_units.size(); ++i) {
+      new_units[i]->relation_map.reserve(degrees[i]);
+    }
+    // Range tiers are not saved but follow from the positions
+    for (uint64_t i = 0; i < header.relation_count; ++i) {
+      AOI::Unit* unit = new_units[relations[i].unit];
+      AOI::Unit* other = new_units[relations[i].other];
+      int relation = relations[i].relation;
+      if (aoi->IsTiered()) {
+        relation |= aoi->GetDistanceTier(unit, other) << AOI::kTierShift;
+      }
+      unit->Relate(other, relation);
+    }
+  }
+
+  munmap(data, size);
+  return true;
+}
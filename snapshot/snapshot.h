@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <type_traits>
+
+#include "aoi.h"
+
+// Snapshot of the units and relations of an AOI, to restart a zone or move
+// it to another process without replaying every add and enter event.
+//
+// The file is flat and holds no pointer, so it is restored straight from
+// mmap. Little-endian hosts are assumed:
+//
+//   SnapshotHeader
+//   AOI::BulkUnit[unit_count]              at units_offset
+//   SnapshotRelation[relation_count]       at relations_offset
+//
+// Relations refer to units by index and are stored once per pair, from the
+// unit with the smaller index. In pair event mode each relation is an edge
+
+struct SnapshotHeader {
+  char magic[4];
+  uint32_t version;
+  float width;
+  float height;
+  float visible_range;
+  uint32_t pair_event;
+  uint64_t unit_count;
+  uint64_t units_offset;
+  uint64_t relation_count;
+  uint64_t relations_offset;
+};
+
+struct SnapshotRelation {
+  uint32_t unit;
+  uint32_t other;
+  int32_t relation;  // AOI::RelationFlag bits from unit to other
+};
+
+const char kSnapshotMagic[4] = {'A', 'O', 'I', 'S'};
+const uint32_t kSnapshotVersion = 1;
+
+static_assert(std::is_trivially_copyable<AOI::BulkUnit>::value &&
+                  sizeof(AOI::BulkUnit) == 28,
+              "BulkUnit is stored as is in snapshots");
+static_assert(sizeof(SnapshotRelation) == 12,
+              "SnapshotRelation must be packed");
+
+class AOISnapshot {
+ public:
+  // Write the units and relations of aoi into path, it must not be called
+  // during a tick. The file is written aside, synced and renamed, then its
+  // directory is synced, so a crash never leaves a partial snapshot. Moves
+  // deferred by SetDeferUpdates and not processed yet are not saved, call
+  // ProcessUpdates with the default budget first to keep them
+  static bool Save(const AOI& aoi, const char* path);
+
+  // Restore a snapshot into an empty aoi, which must have the same size,
+  // visible range and event mode. The index is built in bulk and relations
+  // are restored as saved, no event is fired. Nothing is loaded and false is
+  // returned if the file is corrupted: duplicate ids, positions out of the
+  // map, or relations which the units can not have or which are repeated
+  static bool Load(const char* path, AOI* aoi);
+};
+
+#endif  // SNAPSHOT_H
@@ -0,0 +1,178 @@
+#include "adaptive_aoi/adaptive_aoi.h"
+#include "tests/test_util.h"
+
+// Apply count random adds, moves and removes to aoi and units
+static void RandomAdaptiveOps(AdaptiveAOI* aoi,
+                              std::map<int, TestUnit>* units,
+                              std::mt19937* rng, int count) {
+  std::uniform_real_distribution<float> delta(-40, 40);
+  int next_id = units->empty() ? 1 : units->rbegin()->first + 1;
+  for (int i = 0; i < count; ++i) {
+    int op = (*rng)() % 10;
+    if (units->empty() || 0 == op) {
+      TestUnit unit{static_cast<float>((*rng)() % 512),
+                    static_cast<float>((*rng)() % 512),
+                    static_cast<int>(1 + (*rng)() % 3),
+                    static_cast<float>((*rng)() % 60),
+                    static_cast<uint32_t>(1 + (*rng)() % 3),
+                    static_cast<int>((*rng)() % 2)};
+      aoi->AddUnit(next_id, unit.x, unit.y, unit.flags, unit.range, unit.mask,
+                   unit.layer);
+      (*units)[next_id++] = unit;
+      continue;
+    }
+    auto it = units->begin();
+    std::advance(it, (*rng)() % units->size());
+    if (1 == op) {
+      aoi->RemoveUnit(it->first);
+      units->erase(it);
+    } else {
+      TestUnit& unit = it->second;
+      unit.x = std::clamp(unit.x + delta(*rng), 0.0f, 512.0f);
+      unit.y = std::clamp(unit.y + delta(*rng), 0.0f, 512.0f);
+      aoi->UpdateUnit(it->first, unit.x, unit.y);
+    }
+  }
+}
+
+TEST(MigrationKeepsRelations) {
+  for (auto model : {AdaptiveAOI::kQuadTree, AdaptiveAOI::kCrosslink}) {
+    EventLog log;
+    AdaptiveAOI::Options options;
+    options.migrate_batch = 50;
+    options.sample_interval = 1000000;  // Only migrate on demand
+    AdaptiveAOI aoi(512, 512, 30, log.Enter(), log.Leave(), options);
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(40);
+    RandomAdaptiveOps(&aoi, &units, &rng, 1000);
+
+    aoi.Migrate(model);
+    CHECK(aoi.migrating());
+    for (int step = 0; step < 100 && aoi.migrating(); ++step) {
+      aoi.BeginTick();
+      RandomAdaptiveOps(&aoi, &units, &rng, 30);
+      aoi.EndTick();
+      aoi.Step();
+      CHECK(SubscribedPairs(aoi.aoi(), units) == ExpectedPairs(units));
+      CHECK(log.pairs == ExpectedPairs(units));
+    }
+    CHECK(!aoi.migrating());
+    CHECK_EQ(aoi.model(), model);
+    CHECK_EQ(aoi.migrations(), 1u);
+
+    // The new model goes on from the same relations
+    RandomAdaptiveOps(&aoi, &units, &rng, 1000);
+    CHECK(SubscribedPairs(aoi.aoi(), units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(MigrationKeepsDeferredMoves) {
+  for (auto model : {AdaptiveAOI::kQuadTree, AdaptiveAOI::kCrosslink}) {
+    EventLog log;
+    AdaptiveAOI::Options options;
+    options.migrate_batch = 50;
+    options.sample_interval = 1000000;
+    AdaptiveAOI aoi(512, 512, 30, log.Enter(), log.Leave(), options);
+    aoi.SetDeferUpdates(true);
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(42);
+    for (int id = 1; id <= 300; ++id) {
+      TestUnit unit{static_cast<float>(rng() % 512),
+                    static_cast<float>(rng() % 512), 3, 30, AOI::kAllMask, 0};
+      aoi.AddUnit(id, unit.x, unit.y);
+      units[id] = unit;
+    }
+    RandomAdaptiveOps(&aoi, &units, &rng, 1000);
+    AOI::UpdateBudget budget;
+    budget.max_units = 5;
+    aoi.ProcessUpdates(budget);
+
+    aoi.Migrate(model);
+    for (int step = 0; step < 100 && aoi.migrating(); ++step) {
+      RandomAdaptiveOps(&aoi, &units, &rng, 30);
+      aoi.Step();
+      aoi.ProcessUpdates(budget);
+    }
+    CHECK(!aoi.migrating());
+    CHECK_EQ(aoi.model(), model);
+
+    // The new model defers moves, and has all units where they were moved
+    // once processed
+    RandomAdaptiveOps(&aoi, &units, &rng, 100);
+    CHECK(aoi.GetUpdateBacklog().units > 0);
+    aoi.ProcessUpdates(AOI::UpdateBudget());
+    CHECK_EQ(aoi.GetUpdateBacklog().units, 0u);
+    CHECK(SubscribedPairs(aoi.aoi(), units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(MigrationKeepsLargeRange) {
+  EventLog log;
+  AdaptiveAOI::Options options;
+  options.migrate_batch = 50;
+  options.sample_interval = 1000000;
+  AdaptiveAOI aoi(512, 512, 30, log.Enter(), log.Leave(), options);
+  aoi.SetLargeRange(40);
+  std::map<int, TestUnit> units;
+  std::mt19937 rng(43);
+  for (int id = 1; id <= 300; ++id) {
+    TestUnit unit{static_cast<float>(rng() % 512),
+                  static_cast<float>(rng() % 512), 3,
+                  id % 10 ? 30.0f : 100.0f, AOI::kAllMask, 0};
+    aoi.AddUnit(id, unit.x, unit.y, unit.flags, unit.range);
+    units[id] = unit;
+  }
+  aoi.Migrate(AdaptiveAOI::kQuadTree);
+  for (int step = 0; step < 100 && aoi.migrating(); ++step) {
+    RandomAdaptiveOps(&aoi, &units, &rng, 30);
+    aoi.Step();
+  }
+  CHECK_EQ(aoi.model(), AdaptiveAOI::kQuadTree);
+  CHECK_EQ(aoi.aoi().get_large_range(), 40.0f);
+  RandomAdaptiveOps(&aoi, &units, &rng, 300);
+  CHECK(SubscribedPairs(aoi.aoi(), units) == ExpectedPairs(units));
+  CHECK(log.pairs == ExpectedPairs(units));
+  CHECK_EQ(log.errors, 0);
+}
+
+TEST(CrowdingPicksModel) {
+  EventLog log;
+  AdaptiveAOI::Options options;
+  options.sample_interval = 1;
+  options.patience = 2;
+  AdaptiveAOI aoi(1024, 1024, 30, log.Enter(), log.Leave(), options);
+  CHECK_EQ(aoi.model(), AdaptiveAOI::kTower);
+
+  // Units crowd into a few cells and keep moving
+  std::mt19937 rng(41);
+  std::uniform_real_distribution<float> spot(0, 20);
+  for (int id = 1; id <= 400; ++id) {
+    aoi.AddUnit(id, 500 + spot(rng), 500 + spot(rng));
+  }
+  for (int step = 0; step < 20; ++step) {
+    for (int id = 1; id <= 400; ++id) {
+      aoi.UpdateUnit(id, 500 + spot(rng), 500 + spot(rng));
+    }
+    aoi.Step();
+  }
+  CHECK(aoi.crowding() > options.crowded);
+  CHECK_EQ(aoi.model(), AdaptiveAOI::kQuadTree);
+  CHECK_EQ(aoi.migrations(), 1u);
+
+  // Spread out again
+  std::uniform_real_distribution<float> anywhere(0, 1024);
+  for (int step = 0; step < 20; ++step) {
+    for (int id = 1; id <= 400; ++id) {
+      aoi.UpdateUnit(id, anywhere(rng), anywhere(rng));
+    }
+    aoi.Step();
+  }
+  CHECK(aoi.crowding() < options.sparse);
+  CHECK_EQ(aoi.model(), AdaptiveAOI::kTower);
+  CHECK_EQ(aoi.migrations(), 2u);
+  CHECK_EQ(log.errors, 0);
+}
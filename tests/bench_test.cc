@@ -0,0 +1,22 @@
+#include "bench/bench_util.h"
+#include "tests/test_util.h"
+
+TEST(PercentileOfSortedSamples) {
+  CHECK_EQ(Percentile({}, 0.5), 0);
+  CHECK_EQ(Percentile({7}, 0.999), 7);
+
+  std::vector<int64_t> samples;
+  for (int64_t i = 1; i <= 1001; ++i) {
+    samples.push_back(i);
+  }
+  CHECK_EQ(Percentile(samples, 0), 1);
+  CHECK_EQ(Percentile(samples, 0.5), 501);
+  CHECK_EQ(Percentile(samples, 0.99), 991);
+  CHECK_EQ(Percentile(samples, 0.999), 1000);
+  CHECK_EQ(Percentile(samples, 1), 1001);
+}
+
+TEST(PeakRSSIsMeasured) {
+  ResetPeakRSS();
+  CHECK(GetPeakRSS() > 0);
+}
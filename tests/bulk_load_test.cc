@@ -0,0 +1,78 @@
+#include "tests/test_util.h"
+
+static std::vector<AOI::BulkUnit> RandomBulkUnits(
+    int count, std::mt19937* rng, std::map<int, TestUnit>* units) {
+  std::vector<AOI::BulkUnit> bulk_units;
+  for (int id = 1; id <= count; ++id) {
+    TestUnit unit{static_cast<float>((*rng)() % 512),
+                  static_cast<float>((*rng)() % 512),
+                  static_cast<int>(1 + (*rng)() % 3),
+                  static_cast<float>((*rng)() % 60),
+                  static_cast<uint32_t>(1 + (*rng)() % 3),
+                  static_cast<int>((*rng)() % 2)};
+    bulk_units.emplace_back(id, unit.x, unit.y, unit.flags, unit.range,
+                            unit.mask, unit.layer);
+    (*units)[id] = unit;
+  }
+  return bulk_units;
+}
+
+TEST(BulkLoadMatchesBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    for (bool notify : {false, true}) {
+      EventLog log;
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+      std::map<int, TestUnit> units;
+      std::mt19937 rng(35);
+      aoi->BulkLoad(RandomBulkUnits(1500, &rng, &units), notify);
+      CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+      CHECK(notify ? log.pairs == ExpectedPairs(units) : log.pairs.empty());
+
+      // Loaded units behave like added ones
+      if (notify) {
+        auto new_unit = [&rng](int) {
+          return TestUnit{static_cast<float>(rng() % 512),
+                          static_cast<float>(rng() % 512), 3, 30, 1, 0};
+        };
+        RandomOps(aoi.get(), &units, &rng, 2000, 40, new_unit);
+        CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+        CHECK(log.pairs == ExpectedPairs(units));
+      }
+      CHECK_EQ(log.errors, 0);
+    }
+  }
+}
+
+TEST(BulkLoadDefaultRangeAndPairMode) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    aoi->SetPairEvent(true);
+    aoi->BulkLoad({{1, 10, 10}, {2, 40, 40}, {3, 70, 70}}, true);
+    CHECK((log.pairs == std::set<std::pair<int, int>>{{1, 2}, {2, 3}}));
+    CHECK_EQ(aoi->GetSubScribeSet(2), (std::unordered_set<int>{1, 3}));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(ClearFiresNoEvents) {
+  for (ModelKind kind : kAllModels) {
+    int events = 0;
+    auto callback = [&events](int, int) { ++events; };
+    std::unique_ptr<AOI> aoi = NewModel(kind, 512, 512, 30, callback, callback);
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(36);
+    aoi->BulkLoad(RandomBulkUnits(500, &rng, &units), false);
+    CHECK_EQ(events, 0);
+    aoi->Clear();
+    CHECK_EQ(events, 0);
+
+    // The same ids may be added again
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 20, 20);
+    CHECK_EQ(events, 2);
+    CHECK_EQ(aoi->GetSubScribeSet(1), std::unordered_set<int>{2});
+  }
+}
@@ -0,0 +1,94 @@
+#include "tests/test_util.h"
+
+// Cell counts of the units of layer, units on the edge between two cells
+// belong to the upper one
+static std::vector<uint32_t> BruteForceDensity(
+    const std::map<int, TestUnit>& units, float width, float height,
+    float cell_size, int layer) {
+  int rows = std::max(static_cast<int>(ceil(height / cell_size)), 1);
+  int cols = std::max(static_cast<int>(ceil(width / cell_size)), 1);
+  std::vector<uint32_t> counts(static_cast<size_t>(rows) * cols);
+  for (const auto& pair : units) {
+    const TestUnit& unit = pair.second;
+    if (unit.layer == layer) {
+      int row = std::min(static_cast<int>(floorf(unit.y / cell_size)),
+                         rows - 1);
+      int col = std::min(static_cast<int>(floorf(unit.x / cell_size)),
+                         cols - 1);
+      ++counts[static_cast<size_t>(row) * cols + col];
+    }
+  }
+  return counts;
+}
+
+static size_t BruteForceCount(const std::map<int, TestUnit>& units, float x,
+                              float y, float range, int layer) {
+  size_t count = 0;
+  for (const auto& pair : units) {
+    const TestUnit& unit = pair.second;
+    count += unit.layer == layer && fabsf(unit.x - x) <= range &&
+             fabsf(unit.y - y) <= range;
+  }
+  return count;
+}
+
+TEST(DensityGridOnCellEdges) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    std::map<int, TestUnit> units;
+    int id = 0;
+    for (float x : {0.0f, 64.0f, 128.0f, 256.0f, 512.0f}) {
+      for (float y : {0.0f, 64.0f, 128.0f, 256.0f, 512.0f}) {
+        // Several units per point, so that quad tree nodes split
+        for (int i = 0; i < 5; ++i) {
+          aoi->AddUnit(++id, x, y);
+          units[id] = {x, y, 3, 30, AOI::kAllMask, 0};
+        }
+      }
+    }
+    for (float cell_size : {32.0f, 64.0f, 128.0f, 100.0f, 1000.0f}) {
+      CHECK(aoi->DensityGrid(cell_size, 0) ==
+            BruteForceDensity(units, 512, 512, cell_size, 0));
+    }
+    CHECK_EQ(aoi->CountInRange(64, 64, 0, 0), 5u);
+    CHECK_EQ(aoi->CountInRange(96, 96, 32, 0), 20u);
+  }
+}
+
+TEST(RandomCountsMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 500, 300, 30, [](int, int) {}, [](int, int) {});
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(39);
+    // Positions on a grid of 4 put many units on cell edges
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 126 * 4),
+                      static_cast<float>(rng() % 76 * 4),
+                      static_cast<int>(1 + rng() % 3), 30, AOI::kAllMask,
+                      static_cast<int>(rng() % 2)};
+    };
+    RandomOps(aoi.get(), &units, &rng, 4000, 8, new_unit);
+    for (auto& pair : units) {
+      TestUnit& unit = pair.second;
+      unit.x = roundf(unit.x / 4) * 4;
+      unit.y = roundf(unit.y / 4) * 4;
+      aoi->UpdateUnit(pair.first, unit.x, unit.y);
+    }
+
+    for (int layer : {0, 1, 2}) {
+      for (float cell_size : {16.0f, 20.0f, 64.0f, 77.0f}) {
+        CHECK(aoi->DensityGrid(cell_size, layer) ==
+              BruteForceDensity(units, 500, 300, cell_size, layer));
+      }
+      for (int i = 0; i < 200; ++i) {
+        float x = static_cast<float>(rng() % 140 * 4) - 20;
+        float y = static_cast<float>(rng() % 90 * 4) - 20;
+        float range = static_cast<float>(rng() % 40 * 4);
+        CHECK_EQ(aoi->CountInRange(x, y, range, layer),
+                 BruteForceCount(units, x, y, range, layer));
+      }
+    }
+  }
+}
@@ -0,0 +1,159 @@
+#include "tests/test_util.h"
+
+TEST(CallbackMoveReplacesDeferredMove) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    AOI* aoi_ptr = nullptr;
+    auto enter = [&](int id, int other_id) {
+      log.Enter()(id, other_id);
+      // Unit 3 has a deferred move to (100, 100) queued behind unit 1
+      if (1 == id && 2 == other_id) {
+        aoi_ptr->UpdateUnit(3, 400, 400);
+      }
+    };
+    std::unique_ptr<AOI> aoi = NewModel(kind, 512, 512, 30, enter, log.Leave());
+    aoi_ptr = aoi.get();
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 300, 300);
+    aoi->AddUnit(3, 90, 90);
+    aoi->SetDeferUpdates(true);
+    aoi->UpdateUnit(1, 290, 290);
+    aoi->UpdateUnit(3, 100, 100);
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 2u);
+
+    CHECK_EQ(aoi->ProcessUpdates(AOI::UpdateBudget()), 1u);
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 0u);
+    CHECK_EQ(aoi->CountInRange(400, 400, 0, 0), 1u);
+    CHECK_EQ(aoi->CountInRange(100, 100, 0, 0), 0u);
+    std::map<int, TestUnit> units = {
+        {1, {290, 290, 3, 30, AOI::kAllMask, 0}},
+        {2, {300, 300, 3, 30, AOI::kAllMask, 0}},
+        {3, {400, 400, 3, 30, AOI::kAllMask, 0}}};
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(DeferredMovesKeepOldPositions) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 20, 20);
+    aoi->SetDeferUpdates(true);
+    aoi->UpdateUnit(2, 300, 300);
+    aoi->UpdateUnit(2, 200, 200);  // Replaces the recorded move
+    CHECK_EQ(aoi->GetSubScribeSet(1), std::unordered_set<int>{2});
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 1u);
+
+    aoi->RemoveUnit(2);
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 0u);
+    aoi->AddUnit(2, 20, 20);
+    aoi->UpdateUnit(2, 200, 200);
+    aoi->SetDeferUpdates(false);
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 0u);
+    CHECK_EQ(aoi->CountInRange(200, 200, 0, 0), 1u);
+    CHECK(log.pairs.empty());
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(UpdateBudgetOrder) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    aoi->AddUnit(1, 0, 0, AOI::kMarker, 0);
+    aoi->AddUnit(2, 0, 0);
+    aoi->AddUnit(3, 0, 0);
+    aoi->SetDeferUpdates(true);
+    AOI::UpdateBudget budget;
+    budget.max_units = 1;
+    budget.max_delay = 2;
+
+    // Watchers first, then longer moves
+    aoi->UpdateUnit(1, 500, 500);
+    aoi->UpdateUnit(2, 10, 10);
+    aoi->UpdateUnit(3, 100, 100);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(100, 100, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(10, 10, 0, 0), 1u);
+    AOI::UpdateBacklog backlog = aoi->GetUpdateBacklog();
+    CHECK_EQ(backlog.units, 1u);
+    CHECK_EQ(backlog.oldest_delay, 2u);
+
+    // Overdue units go before watchers
+    aoi->UpdateUnit(2, 20, 20);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(500, 500, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(20, 20, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 0u);
+  }
+}
+
+TEST(UpdateBudgetOrderFollowsLaterMoves) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    for (int id = 1; id <= 4; ++id) {
+      aoi->AddUnit(id, 0, 0);
+    }
+    aoi->SetDeferUpdates(true);
+    AOI::UpdateBudget budget;
+    budget.max_units = 1;
+    aoi->UpdateUnit(1, 100, 100);
+    aoi->UpdateUnit(2, 50, 50);
+    aoi->UpdateUnit(3, 10, 10);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(100, 100, 0, 0), 1u);
+
+    // A shorter move of 2 goes after 3 and 4, and the move of 4 recorded
+    // before it was removed is dropped
+    aoi->UpdateUnit(2, 5, 5);
+    aoi->UpdateUnit(3, 40, 40);
+    aoi->UpdateUnit(4, 200, 200);
+    aoi->RemoveUnit(4);
+    aoi->AddUnit(4, 0, 0);
+    aoi->UpdateUnit(4, 20, 20);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(40, 40, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(20, 20, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 1u);
+    CHECK_EQ(aoi->CountInRange(5, 5, 0, 0), 1u);
+    CHECK_EQ(aoi->ProcessUpdates(budget), 0u);
+    CHECK_EQ(aoi->CountInRange(200, 200, 0, 0), 0u);
+  }
+}
+
+TEST(RandomDeferredMatchesBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    aoi->SetDeferUpdates(true);
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(41);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 512),
+                      static_cast<float>(rng() % 512),
+                      static_cast<int>(1 + rng() % 3),
+                      static_cast<float>(rng() % 60), AOI::kAllMask, 0};
+    };
+    AOI::UpdateBudget budget;
+    budget.max_units = 20;
+    for (int tick = 0; tick < 100; ++tick) {
+      RandomOps(aoi.get(), &units, &rng, 50, 40, new_unit);
+      aoi->ProcessUpdates(budget);
+      CHECK(aoi->GetUpdateBacklog().oldest_delay <= budget.max_delay + 1);
+    }
+    aoi->ProcessUpdates(AOI::UpdateBudget());
+    CHECK_EQ(aoi->GetUpdateBacklog().units, 0u);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
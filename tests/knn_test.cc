@@ -0,0 +1,86 @@
+#include "quadtree_aoi/quadtree_aoi.h"
+#include "tests/test_util.h"
+#include "tower_aoi/tower_aoi.h"
+
+// The k units of layer matching mask nearest to (x, y) within max_range,
+// ordered by distance then id
+static std::vector<std::pair<float, int>> BruteForceNearest(
+    const std::map<int, TestUnit>& units, float x, float y, int layer,
+    uint32_t mask, int exclude, size_t k, float max_range) {
+  std::vector<std::pair<float, int>> nearest;
+  for (const auto& pair : units) {
+    const TestUnit& unit = pair.second;
+    float dx = unit.x - x;
+    float dy = unit.y - y;
+    float distance_sq = dx * dx + dy * dy;
+    if (pair.first != exclude && unit.layer == layer &&
+        0 != (unit.mask & mask) && distance_sq <= max_range * max_range) {
+      nearest.emplace_back(distance_sq, pair.first);
+    }
+  }
+  std::sort(nearest.begin(), nearest.end());
+  nearest.resize(std::min(k, nearest.size()));
+  return nearest;
+}
+
+template <class AOIImpl>
+static void CheckNearest(uint32_t seed) {
+  AOIImpl aoi(512, 512, 30, [](int, int) {}, [](int, int) {});
+  std::map<int, TestUnit> units;
+  std::mt19937 rng(seed);
+  // Integer positions make ties frequent
+  auto new_unit = [&rng](int) {
+    return TestUnit{static_cast<float>(rng() % 128),
+                    static_cast<float>(rng() % 128),
+                    static_cast<int>(1 + rng() % 3), 30,
+                    static_cast<uint32_t>(1 + rng() % 3),
+                    static_cast<int>(rng() % 2)};
+  };
+  RandomOps(&aoi, &units, &rng, 1500, 8, new_unit);
+
+  AOI::Neighbor result[64];
+  for (int i = 0; i < 300; ++i) {
+    size_t k = rng() % 20;
+    float max_range = static_cast<float>(rng() % 200);
+    std::vector<std::pair<float, int>> expected;
+    size_t count;
+    if (i % 2 == 0) {
+      auto it = units.begin();
+      std::advance(it, rng() % units.size());
+      const TestUnit& unit = it->second;
+      expected = BruteForceNearest(units, unit.x, unit.y, unit.layer,
+                                   unit.mask, it->first, k, max_range);
+      count = aoi.FindKNearest(it->first, k, max_range, result);
+    } else {
+      float x = static_cast<float>(rng() % 512);
+      float y = static_cast<float>(rng() % 512);
+      int layer = rng() % 2;
+      uint32_t mask = 1 + rng() % 3;
+      expected =
+          BruteForceNearest(units, x, y, layer, mask, 0, k, max_range);
+      count = aoi.FindKNearest(x, y, layer, mask, k, max_range, result);
+    }
+    CHECK_EQ(count, expected.size());
+    for (size_t j = 0; j < std::min(count, expected.size()); ++j) {
+      CHECK_EQ(result[j].id, expected[j].second);
+      CHECK_EQ(result[j].distance, sqrtf(expected[j].first));
+    }
+  }
+}
+
+TEST(TowerNearestMatchesBruteForce) { CheckNearest<TowerAOI>(37); }
+
+TEST(QuadTreeNearestMatchesBruteForce) { CheckNearest<QuadTreeAOI>(37); }
+
+TEST(NearestInEmptyLayer) {
+  TowerAOI tower(512, 512, 30, [](int, int) {}, [](int, int) {});
+  QuadTreeAOI quad_tree(512, 512, 30, [](int, int) {}, [](int, int) {});
+  AOI::Neighbor result[4];
+  CHECK_EQ(tower.FindKNearest(10, 10, 5, AOI::kAllMask, 4, 100, result), 0u);
+  CHECK_EQ(quad_tree.FindKNearest(10, 10, 5, AOI::kAllMask, 4, 100, result),
+           0u);
+  tower.AddUnit(1, 10, 10);
+  quad_tree.AddUnit(1, 10, 10);
+  CHECK_EQ(tower.FindKNearest(1, 4, 100, result), 0u);
+  CHECK_EQ(quad_tree.FindKNearest(1, 4, 100, result), 0u);
+}
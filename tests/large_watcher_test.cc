@@ -0,0 +1,87 @@
+#include "tests/test_util.h"
+
+// Mostly common units, with some large and broadcast watchers
+static TestUnit RandomUnit(std::mt19937* rng) {
+  float range = static_cast<float>((*rng)() % 40);
+  int kind = (*rng)() % 20;
+  if (0 == kind) {
+    range = INFINITY;
+  } else if (kind < 3) {
+    range = static_cast<float>(100 + (*rng)() % 400);
+  }
+  return TestUnit{static_cast<float>((*rng)() % 512),
+                  static_cast<float>((*rng)() % 512),
+                  static_cast<int>(1 + (*rng)() % 3), range,
+                  static_cast<uint32_t>(1 + (*rng)() % 3),
+                  static_cast<int>((*rng)() % 2)};
+}
+
+TEST(LargeWatchersMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    for (bool lower_large_range : {false, true}) {
+      EventLog log;
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+      if (lower_large_range) {
+        aoi->SetLargeRange(50);
+      }
+      std::map<int, TestUnit> units;
+      std::mt19937 rng(43);
+      auto new_unit = [&rng](int) { return RandomUnit(&rng); };
+      for (int tick = 0; tick < 30; ++tick) {
+        aoi->BeginTick();
+        RandomOps(aoi.get(), &units, &rng, 50, 60, new_unit);
+        aoi->EndTick();
+        RandomOps(aoi.get(), &units, &rng, 50, 60, new_unit);
+      }
+      CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+      CHECK(log.pairs == ExpectedPairs(units));
+      CHECK_EQ(log.errors, 0);
+    }
+  }
+}
+
+TEST(BulkLoadLargeWatchers) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    std::map<int, TestUnit> units;
+    std::vector<AOI::BulkUnit> bulk_units;
+    std::mt19937 rng(44);
+    for (int id = 1; id <= 1000; ++id) {
+      TestUnit unit = RandomUnit(&rng);
+      bulk_units.emplace_back(id, unit.x, unit.y, unit.flags, unit.range,
+                              unit.mask, unit.layer);
+      units[id] = unit;
+    }
+    aoi->BulkLoad(bulk_units, true);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+
+    auto new_unit = [&rng](int) { return RandomUnit(&rng); };
+    RandomOps(aoi.get(), &units, &rng, 1000, 60, new_unit);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(BroadcastWatcherSeesWholeMap) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    aoi->AddUnit(1, 256, 256, AOI::kWatcher, INFINITY);
+    aoi->AddUnit(2, 0, 0, AOI::kMarker, 0);
+    aoi->AddUnit(3, 512, 512, AOI::kMarker, 0);
+    aoi->AddUnit(4, 512, 0, AOI::kMarker, 0, 1, 1);  // Other layer
+    CHECK((aoi->GetSubScribeSet(1) == std::unordered_set<int>{2, 3}));
+    aoi->UpdateUnit(2, 500, 10);
+    aoi->UpdateUnit(1, 0, 512);
+    CHECK((aoi->GetSubScribeSet(1) == std::unordered_set<int>{2, 3}));
+    aoi->RemoveUnit(1);
+    CHECK(log.pairs.empty());
+    CHECK_EQ(log.errors, 0);
+  }
+}
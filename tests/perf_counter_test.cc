@@ -0,0 +1,34 @@
+#include "bench/perf_counter.h"
+#include "tests/test_util.h"
+
+TEST(PerfCountersReadOrReportUnavailable) {
+  PerfCounters perf;
+  bool any = false;
+  for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+    CHECK(nullptr != PerfCounters::Name(i));
+    any = any || perf.available(i);
+  }
+  CHECK_EQ(perf.any_available(), any);
+
+  uint64_t before[PerfCounters::kEventCount];
+  uint64_t after[PerfCounters::kEventCount];
+  perf.Read(before);
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 1000000; ++i) {
+    sum = sum + i;
+  }
+  perf.Read(after);
+  for (int i = 0; i < PerfCounters::kEventCount; ++i) {
+    if (!perf.available(i)) {
+      CHECK_EQ(before[i], 0u);
+      CHECK_EQ(after[i], 0u);
+    } else {
+      CHECK(after[i] >= before[i]);
+    }
+  }
+  if (perf.available(PerfCounters::kInstructions)) {
+    CHECK(after[PerfCounters::kInstructions] -
+              before[PerfCounters::kInstructions] >=
+          1000000);
+  }
+}
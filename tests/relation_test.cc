@@ -0,0 +1,243 @@
+#include "tests/test_util.h"
+
+TEST(WatcherAndMarkerRoles) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 1024, 1024, 30, log.Enter(), log.Leave());
+    aoi->AddUnit(1, 20, 20, AOI::kWatcher, 60);  // Scout, never observed
+    aoi->AddUnit(2, 10, 10, AOI::kMarker, 0);    // NPC, never notified
+    aoi->AddUnit(3, 30, 30);
+    CHECK((log.pairs ==
+           std::set<std::pair<int, int>>{{1, 2}, {1, 3}, {3, 2}}));
+    CHECK(aoi->GetSubScribeSet(2).empty());
+
+    // Asymmetric ranges: 4 sees 5 from 40 away, 5 sees nothing that far
+    aoi->AddUnit(4, 500, 500, AOI::kWatcher | AOI::kMarker, 50);
+    aoi->AddUnit(5, 540, 500, AOI::kWatcher | AOI::kMarker, 10);
+    CHECK_EQ(aoi->GetSubScribeSet(4), std::unordered_set<int>{5});
+    CHECK(aoi->GetSubScribeSet(5).empty());
+
+    aoi->UpdateUnit(2, 200, 200);
+    CHECK_EQ(log.pairs.count({1, 2}), 0u);
+    CHECK_EQ(log.pairs.count({3, 2}), 0u);
+    aoi->RemoveUnit(4);
+    CHECK_EQ(log.pairs.count({4, 5}), 0u);
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(RandomRolesMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(26);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 512),
+                      static_cast<float>(rng() % 512),
+                      static_cast<int>(1 + rng() % 3),
+                      static_cast<float>(rng() % 60), AOI::kAllMask, 0};
+    };
+    RandomOps(aoi.get(), &units, &rng, 3000, 40, new_unit);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(PairEventsOncePerPair) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    aoi->SetPairEvent(true);
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(27);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 512),
+                      static_cast<float>(rng() % 512),
+                      AOI::kWatcher | AOI::kMarker, 30, AOI::kAllMask, 0};
+    };
+    RandomOps(aoi.get(), &units, &rng, 3000, 40, new_unit);
+
+    // One (a, b) event with a < b per pair, both sides subscribed
+    std::set<std::pair<int, int>> expected;
+    for (const auto& pair : ExpectedPairs(units)) {
+      if (pair.first < pair.second) {
+        expected.insert(pair);
+      }
+    }
+    CHECK(log.pairs == expected);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(TickCoalescesEvents) {
+  for (ModelKind kind : kAllModels) {
+    for (bool pair_event : {false, true}) {
+      EventLog log;
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+      aoi->SetPairEvent(pair_event);
+      aoi->AddUnit(1, 1, 1);
+      aoi->AddUnit(2, 2, 2);
+      size_t pairs = log.pairs.size();
+
+      // Out and back within a tick cancels out
+      aoi->BeginTick();
+      aoi->UpdateUnit(1, 500, 500);
+      aoi->UpdateUnit(1, 1, 1);
+      aoi->EndTick();
+      CHECK_EQ(log.pairs.size(), pairs);
+
+      // A removed id added again is another entity: leave then enter
+      int leaves = 0;
+      int enters = 0;
+      std::unique_ptr<AOI> counted = NewModel(
+          kind, 512, 512, 30, [&enters](int, int) { ++enters; },
+          [&leaves](int, int) { ++leaves; });
+      counted->SetPairEvent(pair_event);
+      counted->AddUnit(1, 1, 1);
+      counted->AddUnit(2, 2, 2);
+      enters = 0;
+      counted->BeginTick();
+      counted->RemoveUnit(2);
+      counted->AddUnit(2, 3, 3);
+      counted->EndTick();
+      CHECK_EQ(leaves, pair_event ? 1 : 2);
+      CHECK_EQ(enters, pair_event ? 1 : 2);
+      CHECK_EQ(log.errors, 0);
+    }
+  }
+}
+
+TEST(RandomTicksMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(28);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 512),
+                      static_cast<float>(rng() % 512),
+                      static_cast<int>(1 + rng() % 3),
+                      static_cast<float>(rng() % 60), AOI::kAllMask, 0};
+    };
+    for (int tick = 0; tick < 50; ++tick) {
+      aoi->BeginTick();
+      RandomOps(aoi.get(), &units, &rng, 60, 40, new_unit);
+      // Also remove and add again the same ids within the tick
+      if (!units.empty()) {
+        auto it = units.begin();
+        std::advance(it, rng() % units.size());
+        const TestUnit& unit = it->second;
+        aoi->RemoveUnit(it->first);
+        aoi->AddUnit(it->first, unit.x, unit.y, unit.flags, unit.range,
+                     unit.mask, unit.layer);
+      }
+      aoi->EndTick();
+    }
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(EndTickCallbacksMayBeginTick) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    AOI* aoi_ptr = nullptr;
+    bool moved = false;
+    auto enter = [&](int id, int other_id) {
+      log.Enter()(id, other_id);
+      // Begin the next tick and move a unit from within the callback
+      if (!moved) {
+        moved = true;
+        aoi_ptr->BeginTick();
+        aoi_ptr->UpdateUnit(3, 400, 400);
+        aoi_ptr->EndTick();
+      }
+    };
+    std::unique_ptr<AOI> aoi = NewModel(kind, 512, 512, 30, enter, log.Leave());
+    aoi_ptr = aoi.get();
+    aoi->AddUnit(3, 300, 300);
+    aoi->BeginTick();
+    aoi->AddUnit(1, 1, 1);
+    aoi->AddUnit(2, 2, 2);
+    aoi->EndTick();
+    std::map<int, TestUnit> units = {
+        {1, {1, 1, 3, 30, AOI::kAllMask, 0}},
+        {2, {2, 2, 3, 30, AOI::kAllMask, 0}},
+        {3, {400, 400, 3, 30, AOI::kAllMask, 0}}};
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(RandomMasksAndLayersMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(29);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 512),
+                      static_cast<float>(rng() % 512),
+                      AOI::kWatcher | AOI::kMarker, 40,
+                      static_cast<uint32_t>(1 + rng() % 7),
+                      static_cast<int>(rng() % 3)};
+    };
+    RandomOps(aoi.get(), &units, &rng, 3000, 40, new_unit);
+    CHECK(SubscribedPairs(*aoi, units) == ExpectedPairs(units));
+    CHECK(log.pairs == ExpectedPairs(units));
+    CHECK_EQ(log.errors, 0);
+  }
+}
+
+TEST(EmptiedLayersAreFreedAndReused) {
+  for (ModelKind kind : kAllModels) {
+    EventLog log;
+    AOI* aoi_ptr = nullptr;
+    bool refill = false;
+    auto leave = [&](int id, int other_id) {
+      log.Leave()(id, other_id);
+      // Refill the layer being emptied from within the callback
+      if (refill && 2 == id && 1 == other_id) {
+        aoi_ptr->AddUnit(3, 10, 10, AOI::kWatcher | AOI::kMarker, 30,
+                         AOI::kAllMask, 7);
+      }
+    };
+    std::unique_ptr<AOI> aoi = NewModel(kind, 512, 512, 30, log.Enter(), leave);
+    aoi_ptr = aoi.get();
+
+    // Many short lived layers, each emptied before the next one
+    for (int layer = 100; layer < 1100; ++layer) {
+      aoi->AddUnit(1, 100, 100, AOI::kWatcher | AOI::kMarker, 30,
+                   AOI::kAllMask, layer);
+      aoi->AddUnit(2, 110, 110, AOI::kWatcher | AOI::kMarker, 30,
+                   AOI::kAllMask, layer);
+      aoi->RemoveUnit(1);
+      aoi->RemoveUnit(2);
+      CHECK_EQ(aoi->CountInRange(100, 100, 50, layer), 0u);
+    }
+    CHECK(log.pairs.empty());
+
+    refill = true;
+    aoi->AddUnit(1, 10, 10, AOI::kWatcher | AOI::kMarker, 30, AOI::kAllMask,
+                 7);
+    aoi->AddUnit(2, 12, 12, AOI::kWatcher | AOI::kMarker, 30, AOI::kAllMask,
+                 7);
+    aoi->RemoveUnit(1);
+    aoi->RemoveUnit(2);
+    CHECK_EQ(aoi->CountInRange(10, 10, 30, 7), 1u);
+    aoi->AddUnit(4, 20, 20, AOI::kWatcher | AOI::kMarker, 30, AOI::kAllMask,
+                 7);
+    CHECK((log.pairs == std::set<std::pair<int, int>>{{3, 4}, {4, 3}}));
+    CHECK_EQ(log.errors, 0);
+  }
+}
@@ -0,0 +1,108 @@
+#include "aoi_shape.h"
+#include "tests/test_util.h"
+
+static bool ContainsPoint(const AOIShape& shape, float x, float y) {
+  uint8_t inside = 0;
+  shape.Contains(&x, &y, 1, &inside);
+  return inside;
+}
+
+static AOIShape RandomShape(std::mt19937* rng) {
+  std::uniform_real_distribution<float> position(-50, 562);
+  std::uniform_real_distribution<float> length(0, 120);
+  std::uniform_real_distribution<float> angle(-M_PI, M_PI);
+  std::uniform_real_distribution<float> half_angle(0, M_PI);
+  float x = position(*rng);
+  float y = position(*rng);
+  switch ((*rng)() % 3) {
+    case 0: {
+      float radius = length(*rng);
+      return AOIShape::Circle(x, y, radius, (*rng)() % 2 ? radius / 2 : 0);
+    }
+    case 1:
+      return AOIShape::Rect(x, y, length(*rng), length(*rng) / 4,
+                            angle(*rng));
+    default: {
+      float radius = length(*rng);
+      return AOIShape::Sector(x, y, radius, angle(*rng), half_angle(*rng),
+                              (*rng)() % 2 ? radius / 3 : 0);
+    }
+  }
+}
+
+TEST(ShapesMatchBruteForce) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    std::map<int, TestUnit> units;
+    std::mt19937 rng(38);
+    auto new_unit = [&rng](int) {
+      return TestUnit{static_cast<float>(rng() % 5120) / 10,
+                      static_cast<float>(rng() % 5120) / 10,
+                      static_cast<int>(1 + rng() % 3), 30,
+                      static_cast<uint32_t>(1 + rng() % 3),
+                      static_cast<int>(rng() % 2)};
+    };
+    RandomOps(aoi.get(), &units, &rng, 3000, 20, new_unit);
+
+    for (int i = 0; i < 500; ++i) {
+      AOIShape shape = RandomShape(&rng);
+      int layer = rng() % 2;
+      uint32_t mask = 1 + rng() % 3;
+      std::vector<AOI::UnitID> found;
+      size_t count = aoi->FindInShape(shape, layer, mask, &found);
+      CHECK_EQ(count, found.size());
+      std::sort(found.begin(), found.end());
+
+      std::vector<AOI::UnitID> expected;
+      for (const auto& pair : units) {
+        const TestUnit& unit = pair.second;
+        if (unit.layer == layer && 0 != (unit.mask & mask) &&
+            ContainsPoint(shape, unit.x, unit.y)) {
+          expected.push_back(pair.first);
+        }
+      }
+      CHECK(found == expected);
+    }
+  }
+}
+
+TEST(ShapeContainsGeometry) {
+  // Points are tested against the definitions of the shapes in double, away
+  // from their edges where rounding may differ
+  std::mt19937 rng(39);
+  std::uniform_real_distribution<double> offset(-150, 150);
+  const double kMargin = 1e-3;
+  for (int i = 0; i < 300; ++i) {
+    AOIShape shape = RandomShape(&rng);
+    double angle = atan2(shape.dir_y, shape.dir_x);
+    for (int j = 0; j < 200; ++j) {
+      double dx = offset(rng);
+      double dy = offset(rng);
+      double distance = sqrt(dx * dx + dy * dy);
+      double margin;
+      bool inside;
+      if (AOIShape::kRect == shape.type) {
+        double forward = dx * cos(angle) + dy * sin(angle);
+        double side = dy * cos(angle) - dx * sin(angle);
+        margin = std::min(fabs(fabs(forward) - shape.half_length),
+                          fabs(fabs(side) - shape.half_width));
+        inside = fabs(forward) <= shape.half_length &&
+                 fabs(side) <= shape.half_width;
+      } else {
+        margin = std::min(fabs(distance - shape.radius),
+                          fabs(distance - shape.inner_radius));
+        inside = distance <= shape.radius && distance >= shape.inner_radius;
+        if (AOIShape::kSector == shape.type) {
+          double turn = remainder(atan2(dy, dx) - angle, 2 * M_PI);
+          margin = std::min(
+              margin, distance * fabs(fabs(turn) - shape.half_angle));
+          inside = inside && fabs(turn) <= shape.half_angle;
+        }
+      }
+      if (margin > kMargin * std::max(1.0, distance)) {
+        CHECK_EQ(ContainsPoint(shape, shape.x + dx, shape.y + dy), inside);
+      }
+    }
+  }
+}
@@ -0,0 +1,230 @@
+#include <cstring>
+
+#include "snapshot/snapshot.h"
+#include "tests/test_util.h"
+#include "tower_aoi/tower_aoi.h"
+
+TEST(SnapshotRoundTrip) {
+  std::string path = TempPath("round_trip.aois");
+  for (ModelKind kind : kAllModels) {
+    for (bool pair_event : {false, true}) {
+      EventLog log;
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+      aoi->SetPairEvent(pair_event);
+      std::map<int, TestUnit> units;
+      std::mt19937 rng(36);
+      auto new_unit = [&rng, pair_event](int) {
+        if (pair_event) {
+          return TestUnit{static_cast<float>(rng() % 512),
+                          static_cast<float>(rng() % 512),
+                          AOI::kWatcher | AOI::kMarker, 30, AOI::kAllMask,
+                          0};
+        }
+        return TestUnit{static_cast<float>(rng() % 512),
+                        static_cast<float>(rng() % 512),
+                        static_cast<int>(1 + rng() % 3),
+                        static_cast<float>(rng() % 60),
+                        static_cast<uint32_t>(1 + rng() % 3),
+                        static_cast<int>(rng() % 2)};
+      };
+      RandomOps(aoi.get(), &units, &rng, 2000, 40, new_unit);
+      CHECK(AOISnapshot::Save(*aoi, path.c_str()));
+
+      // Restore into every model, then go on with the same operations
+      for (ModelKind restored_kind : kAllModels) {
+        EventLog restored_log;
+        std::unique_ptr<AOI> restored =
+            NewModel(restored_kind, 512, 512, 30, restored_log.Enter(),
+                     restored_log.Leave());
+        restored->SetPairEvent(pair_event);
+        CHECK(AOISnapshot::Load(path.c_str(), restored.get()));
+        CHECK(restored_log.pairs.empty());
+        CHECK(SubscribedPairs(*restored, units) ==
+              SubscribedPairs(*aoi, units));
+
+        restored_log.pairs = log.pairs;
+        std::map<int, TestUnit> restored_units = units;
+        std::mt19937 restored_rng(37);
+        RandomOps(restored.get(), &restored_units, &restored_rng, 1000, 40,
+                  new_unit);
+        CHECK(SubscribedPairs(*restored, restored_units) ==
+              ExpectedPairs(restored_units));
+        CHECK_EQ(restored_log.errors, 0);
+      }
+
+      // Only empty models with the same settings accept a snapshot
+      std::unique_ptr<AOI> other_range =
+          NewModel(kind, 512, 512, 40, log.Enter(), log.Leave());
+      other_range->SetPairEvent(pair_event);
+      CHECK(!AOISnapshot::Load(path.c_str(), other_range.get()));
+      std::unique_ptr<AOI> other_mode =
+          NewModel(kind, 512, 512, 30, log.Enter(), log.Leave());
+      other_mode->SetPairEvent(!pair_event);
+      CHECK(!AOISnapshot::Load(path.c_str(), other_mode.get()));
+      CHECK(!AOISnapshot::Load(path.c_str(), aoi.get()));
+      CHECK_EQ(log.errors, 0);
+    }
+  }
+  unlink(path.c_str());
+}
+
+// Write a snapshot of a 512 * 512 map with visible range 30 by hand
+static void WriteSnapshot(const std::string& path, bool pair_event,
+                          const std::vector<AOI::BulkUnit>& units,
+                          const std::vector<SnapshotRelation>& relations) {
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.width = 512;
+  header.height = 512;
+  header.visible_range = 30;
+  header.pair_event = pair_event;
+  header.unit_count = units.size();
+  header.units_offset = sizeof(header);
+  header.relation_count = relations.size();
+  header.relations_offset =
+      header.units_offset + units.size() * sizeof(AOI::BulkUnit);
+  FILE* fp = fopen(path.c_str(), "wb");
+  fwrite(&header, sizeof(header), 1, fp);
+  if (!units.empty()) {
+    fwrite(units.data(), sizeof(AOI::BulkUnit), units.size(), fp);
+  }
+  if (!relations.empty()) {
+    fwrite(relations.data(), sizeof(SnapshotRelation), relations.size(), fp);
+  }
+  fclose(fp);
+}
+
+TEST(SnapshotRejectsCorruptedFiles) {
+  std::string path = TempPath("corrupted.aois");
+  const int kBoth = AOI::kSubscribe | AOI::kObserved;
+  const AOI::BulkUnit a(1, 10, 10);
+  const AOI::BulkUnit b(2, 20, 20);
+  struct Case {
+    const char* name;
+    bool pair_event;
+    std::vector<AOI::BulkUnit> units;
+    std::vector<SnapshotRelation> relations;
+  };
+  const Case cases[] = {
+      {"duplicate id", false, {a, AOI::BulkUnit(1, 20, 20)}, {}},
+      {"negative x", false, {a, AOI::BulkUnit(2, -1, 20)}, {}},
+      {"y beyond map", false, {a, AOI::BulkUnit(2, 20, 513)}, {}},
+      {"nan x", false, {a, AOI::BulkUnit(2, NAN, 20)}, {}},
+      {"nan range",
+       false,
+       {a, AOI::BulkUnit(2, 20, 20, 3, NAN, AOI::kAllMask, 0)},
+       {}},
+      {"unknown flags",
+       false,
+       {a, AOI::BulkUnit(2, 20, 20, 7, 30, AOI::kAllMask, 0)},
+       {}},
+      {"out of range", false, {a, AOI::BulkUnit(2, 200, 200)}, {{0, 1, 3}}},
+      {"disjoint masks",
+       false,
+       {AOI::BulkUnit(1, 10, 10, 3, 30, 1, 0),
+        AOI::BulkUnit(2, 20, 20, 3, 30, 2, 0)},
+       {{0, 1, kBoth}}},
+      {"other layer",
+       false,
+       {a, AOI::BulkUnit(2, 20, 20, 3, 30, AOI::kAllMask, 1)},
+       {{0, 1, kBoth}}},
+      {"marker only",
+       false,
+       {a, AOI::BulkUnit(2, 20, 20, AOI::kMarker, 30, AOI::kAllMask, 0)},
+       {{0, 1, kBoth}}},
+      {"missing direction", false, {a, b}, {{0, 1, AOI::kSubscribe}}},
+      {"unknown bits", false, {a, b}, {{0, 1, kBoth | 4}}},
+      {"repeated relation", false, {a, b}, {{0, 1, kBoth}, {0, 1, kBoth}}},
+      {"reversed relation", false, {a, b}, {{1, 0, kBoth}}},
+      {"repeated edge", true, {a, b}, {{0, 1, kBoth}, {0, 1, kBoth}}},
+      {"pair with role",
+       true,
+       {a, AOI::BulkUnit(2, 20, 20, AOI::kWatcher, 30, AOI::kAllMask, 0)},
+       {}},
+      {"pair with range",
+       true,
+       {a, AOI::BulkUnit(2, 20, 20, 3, 40, AOI::kAllMask, 0)},
+       {}},
+  };
+
+  for (ModelKind kind : kAllModels) {
+    for (const Case& c : cases) {
+      WriteSnapshot(path, c.pair_event, c.units, c.relations);
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+      aoi->SetPairEvent(c.pair_event);
+      bool loaded = AOISnapshot::Load(path.c_str(), aoi.get());
+      if (loaded) {
+        fprintf(stderr, "Loaded corrupted snapshot: %s\n", c.name);
+      }
+      CHECK(!loaded);
+      CHECK_EQ(aoi->CountInRange(256, 256, 512, 0), 0u);
+    }
+
+    // The same units with their relations load
+    for (bool pair_event : {false, true}) {
+      WriteSnapshot(path, pair_event, {a, b, AOI::BulkUnit(3, 200, 200)},
+                    {{0, 1, kBoth}});
+      std::unique_ptr<AOI> aoi =
+          NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+      aoi->SetPairEvent(pair_event);
+      CHECK(AOISnapshot::Load(path.c_str(), aoi.get()));
+      CHECK_EQ(aoi->GetSubScribeSet(1), std::unordered_set<int>{2});
+      CHECK(aoi->GetSubScribeSet(3).empty());
+    }
+  }
+
+  // Large and broadcast ranges and units without roles load
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 20, 20, 3, 1e6f, AOI::kAllMask, 0);
+    aoi->AddUnit(3, 300, 300, AOI::kWatcher, INFINITY, AOI::kAllMask, 0);
+    aoi->AddUnit(4, 40, 40, 0, 30, AOI::kAllMask, 0);
+    CHECK(AOISnapshot::Save(*aoi, path.c_str()));
+    std::unique_ptr<AOI> restored =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    CHECK(AOISnapshot::Load(path.c_str(), restored.get()));
+    for (int id = 1; id <= 4; ++id) {
+      CHECK_EQ(restored->GetSubScribeSet(id), aoi->GetSubScribeSet(id));
+    }
+    CHECK_EQ(restored->GetSubScribeSet(3),
+             (std::unordered_set<int>{1, 2}));
+  }
+
+  // Unbounded towers accept units beyond the map
+  WriteSnapshot(path, false, {a, AOI::BulkUnit(2, -5, 600)}, {});
+  TowerAOI tower(512, 512, 30, [](int, int) {}, [](int, int) {}, true);
+  CHECK(AOISnapshot::Load(path.c_str(), &tower));
+  unlink(path.c_str());
+}
+
+TEST(SnapshotSkipsDeferredMoves) {
+  std::string path = TempPath("deferred.aois");
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 20, 20);
+    aoi->SetDeferUpdates(true);
+    aoi->UpdateUnit(2, 300, 300);
+    CHECK(AOISnapshot::Save(*aoi, path.c_str()));
+    std::unique_ptr<AOI> restored =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    CHECK(AOISnapshot::Load(path.c_str(), restored.get()));
+    CHECK_EQ(restored->GetSubScribeSet(1), std::unordered_set<int>{2});
+
+    aoi->ProcessUpdates(AOI::UpdateBudget());
+    CHECK(AOISnapshot::Save(*aoi, path.c_str()));
+    restored =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    CHECK(AOISnapshot::Load(path.c_str(), restored.get()));
+    CHECK(restored->GetSubScribeSet(1).empty());
+    CHECK_EQ(restored->CountInRange(300, 300, 1, 0), 1u);
+  }
+  unlink(path.c_str());
+}
@@ -0,0 +1,62 @@
+#include "aoi_stats.h"
+#include "tests/test_util.h"
+
+TEST(LatencyHistogramPercentiles) {
+  LatencyHistogram histogram;
+  CHECK_EQ(histogram.Percentile(0.5), 0u);
+  CHECK_EQ(histogram.mean(), 0.0);
+
+  // Small values have exact buckets
+  for (uint64_t ns = 1; ns <= 10; ++ns) {
+    histogram.Record(ns);
+  }
+  CHECK_EQ(histogram.count(), 10u);
+  CHECK_EQ(histogram.max(), 10u);
+  CHECK_EQ(histogram.mean(), 5.5);
+  CHECK_EQ(histogram.Percentile(0), 1u);
+  CHECK_EQ(histogram.Percentile(0.5), 5u);
+  CHECK_EQ(histogram.Percentile(1), 10u);
+
+  // Larger values are off by less than 1/16, never above the max
+  histogram.Reset();
+  for (uint64_t ns = 1000; ns <= 100000; ns += 1000) {
+    histogram.Record(ns);
+  }
+  uint64_t p50 = histogram.Percentile(0.5);
+  CHECK(p50 >= 50000 && p50 < 50000 + 50000 / 16);
+  uint64_t p99 = histogram.Percentile(0.99);
+  CHECK(p99 >= 99000 && p99 <= 100000);
+  CHECK_EQ(histogram.Percentile(1), 100000u);
+
+  // Values beyond the last bucket fall in it
+  histogram.Record(uint64_t(1) << 50);
+  CHECK_EQ(histogram.max(), uint64_t(1) << 50);
+  CHECK_EQ(histogram.Percentile(1), uint64_t(1) << 50);
+  CHECK_EQ(histogram.Percentile(0.5), p50);
+}
+
+TEST(StatsCountOnlyWhenEnabled) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    aoi->AddUnit(1, 10, 10);
+    aoi->AddUnit(2, 20, 20);
+    aoi->UpdateUnit(2, 300, 300);
+    aoi->RemoveUnit(1);
+    const AOIStats& stats = aoi->GetStats();
+#ifdef AOI_STATS
+    CHECK(stats.searches >= 3);
+    CHECK(stats.units_scanned > 0);
+    CHECK_EQ(stats.enter_events, 2u);
+    CHECK_EQ(stats.leave_events, 2u);
+    CHECK_EQ(stats.add_latency.count(), 2u);
+    CHECK_EQ(stats.update_latency.count(), 1u);
+    CHECK_EQ(stats.remove_latency.count(), 1u);
+#else
+    CHECK_EQ(stats.searches, 0u);
+    CHECK_EQ(stats.units_scanned, 0u);
+    CHECK_EQ(stats.enter_events, 0u);
+    CHECK_EQ(stats.add_latency.count(), 0u);
+#endif
+  }
+}
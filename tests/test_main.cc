@@ -0,0 +1,34 @@
+#include "crosslink_aoi/crosslink_aoi.h"
+#include "quadtree_aoi/quadtree_aoi.h"
+#include "tests/test_util.h"
+#include "tower_aoi/tower_aoi.h"
+
+std::unique_ptr<AOI> NewModel(ModelKind kind, float width, float height,
+                              float visible_range,
+                              const AOI::Callback& enter_callback,
+                              const AOI::Callback& leave_callback) {
+  switch (kind) {
+    case kTowerModel:
+      return std::make_unique<TowerAOI>(width, height, visible_range,
+                                        enter_callback, leave_callback);
+    case kQuadTreeModel:
+      return std::make_unique<QuadTreeAOI>(width, height, visible_range,
+                                           enter_callback, leave_callback);
+    case kCrosslinkModel:
+      return std::make_unique<CrosslinkAOI>(width, height, visible_range,
+                                            enter_callback, leave_callback);
+  }
+  return nullptr;
+}
+
+int main() {
+  for (const TestCase& test : GetTests()) {
+    int failures = GetFailures();
+    test.func();
+    fprintf(stderr, "%s %s\n", GetFailures() == failures ? "PASS" : "FAIL",
+            test.name);
+  }
+  fprintf(stderr, "%zu tests, %d failed checks\n", GetTests().size(),
+          GetFailures());
+  return 0 == GetFailures() ? 0 : 1;
+}
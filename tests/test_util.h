@@ -0,0 +1,169 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "aoi.h"
+
+// A test registered by TEST(name) and run by test_main.cc. CHECK reports a
+// failure and goes on, so that one run shows every broken expectation
+struct TestCase {
+  const char* name;
+  void (*func)();
+};
+
+inline std::vector<TestCase>& GetTests() {
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+inline int& GetFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+struct TestRegistrar {
+  TestRegistrar(const char* name, void (*func)()) {
+    GetTests().push_back({name, func});
+  }
+};
+
+#define TEST(name)                                          \
+  static void name();                                       \
+  static TestRegistrar name##_registrar(#name, name);       \
+  static void name()
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                   \
+      ++GetFailures();                                                  \
+    }                                                                   \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+// Path of a scratch file of this process under /tmp
+inline std::string TempPath(const char* name) {
+  return std::string("/tmp/aoi_test_") + std::to_string(getpid()) + "_" +
+         name;
+}
+
+// Models under test, created by NewModel
+enum ModelKind { kTowerModel, kQuadTreeModel, kCrosslinkModel };
+const ModelKind kAllModels[] = {kTowerModel, kQuadTreeModel, kCrosslinkModel};
+
+std::unique_ptr<AOI> NewModel(ModelKind kind, float width, float height,
+                              float visible_range,
+                              const AOI::Callback& enter_callback,
+                              const AOI::Callback& leave_callback);
+
+// Directed (id, other_id) pairs as told by the enter and leave events, an
+// enter of a pair already entered or a leave of a pair not entered is an
+// error
+struct EventLog {
+  AOI::Callback Enter() {
+    return [this](int id, int other_id) {
+      errors += !pairs.insert(std::pair(id, other_id)).second;
+    };
+  }
+
+  AOI::Callback Leave() {
+    return [this](int id, int other_id) {
+      errors += 0 == pairs.erase(std::pair(id, other_id));
+    };
+  }
+
+  std::set<std::pair<int, int>> pairs;
+  int errors = 0;
+};
+
+// Brute force model of the units, which tells the expected subscriptions
+struct TestUnit {
+  float x;
+  float y;
+  int flags;
+  float range;
+  uint32_t mask;
+  int layer;
+};
+
+inline bool Sees(const TestUnit& watcher, const TestUnit& marker) {
+  return (watcher.flags & AOI::kWatcher) && (marker.flags & AOI::kMarker) &&
+         watcher.layer == marker.layer && 0 != (watcher.mask & marker.mask) &&
+         fabsf(watcher.x - marker.x) <= watcher.range &&
+         fabsf(watcher.y - marker.y) <= watcher.range;
+}
+
+inline std::set<std::pair<int, int>> ExpectedPairs(
+    const std::map<int, TestUnit>& units) {
+  std::set<std::pair<int, int>> pairs;
+  for (const auto& watcher : units) {
+    for (const auto& marker : units) {
+      if (watcher.first != marker.first &&
+          Sees(watcher.second, marker.second)) {
+        pairs.insert(std::pair(watcher.first, marker.first));
+      }
+    }
+  }
+  return pairs;
+}
+
+// Subscriptions held by aoi for the given units
+inline std::set<std::pair<int, int>> SubscribedPairs(
+    const AOI& aoi, const std::map<int, TestUnit>& units) {
+  std::set<std::pair<int, int>> pairs;
+  for (const auto& pair : units) {
+    for (int other_id : aoi.GetSubScribeSet(pair.first)) {
+      pairs.insert(std::pair(pair.first, other_id));
+    }
+  }
+  return pairs;
+}
+
+// Apply count random adds, moves and removes to aoi and units. New units are
+// made by new_unit(id), and units move within the map by up to step on
+// each axis
+template <class NewUnit>
+void RandomOps(AOI* aoi, std::map<int, TestUnit>* units, std::mt19937* rng,
+               int count, float step, const NewUnit& new_unit) {
+  std::uniform_real_distribution<float> delta(-step, step);
+  int next_id = units->empty() ? 1 : units->rbegin()->first + 1;
+  for (int i = 0; i < count; ++i) {
+    int op = (*rng)() % 10;
+    if (units->empty() || 0 == op) {
+      TestUnit unit = new_unit(next_id);
+      aoi->AddUnit(next_id, unit.x, unit.y, unit.flags, unit.range, unit.mask,
+                   unit.layer);
+      (*units)[next_id++] = unit;
+      continue;
+    }
+    auto it = units->begin();
+    std::advance(it, (*rng)() % units->size());
+    if (1 == op) {
+      aoi->RemoveUnit(it->first);
+      units->erase(it);
+    } else {
+      TestUnit& unit = it->second;
+      unit.x = std::clamp(unit.x + delta(*rng), 0.0f, aoi->get_width());
+      unit.y = std::clamp(unit.y + delta(*rng), 0.0f, aoi->get_height());
+      aoi->UpdateUnit(it->first, unit.x, unit.y);
+    }
+  }
+}
+
+#endif  // TEST_UTIL_H
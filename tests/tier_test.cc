@@ -0,0 +1,90 @@
+#include "tests/test_util.h"
+
+// Tier of a watcher within range of marker, bounds as given to
+// SetRangeTiers
+static int ExpectedTier(const TestUnit& watcher, const TestUnit& marker,
+                        const std::vector<float>& bounds) {
+  float distance =
+      std::max(fabsf(watcher.x - marker.x), fabsf(watcher.y - marker.y));
+  return std::lower_bound(bounds.begin(), bounds.end(), distance) -
+         bounds.begin();
+}
+
+TEST(TierEventsFollowPositions) {
+  const std::vector<float> bounds = {10, 20};
+  for (ModelKind kind : kAllModels) {
+    for (bool pair_event : {false, true}) {
+      for (bool tick : {false, true}) {
+        EventLog log;
+        std::map<std::pair<int, int>, int> tiers;  // Last tier event
+        int tier_errors = 0;
+        auto leave = [&](int id, int other_id) {
+          log.Leave()(id, other_id);
+          tiers.erase(std::pair(id, other_id));
+        };
+        std::unique_ptr<AOI> aoi =
+            NewModel(kind, 512, 512, 30, log.Enter(), leave);
+        aoi->SetPairEvent(pair_event);
+        aoi->SetRangeTiers(bounds, [&](int id, int other_id, int tier) {
+          // A tier event follows the enter event, then tells a new tier
+          auto key = std::pair(id, other_id);
+          auto it = tiers.find(key);
+          tier_errors += 0 == log.pairs.count(key) ||
+                         (it != tiers.end() && it->second == tier);
+          tiers[key] = tier;
+        });
+        std::map<int, TestUnit> units;
+        std::mt19937 rng(42);
+        auto new_unit = [&rng, pair_event](int) {
+          return TestUnit{static_cast<float>(rng() % 256),
+                          static_cast<float>(rng() % 256),
+                          pair_event ? 3 : static_cast<int>(1 + rng() % 3),
+                          pair_event ? 30 : static_cast<float>(rng() % 60),
+                          AOI::kAllMask, 0};
+        };
+        for (int round = 0; round < 100; ++round) {
+          if (tick) {
+            aoi->BeginTick();
+          }
+          RandomOps(aoi.get(), &units, &rng, 30, 12, new_unit);
+          if (tick) {
+            aoi->EndTick();
+          }
+        }
+
+        for (const auto& pair : ExpectedPairs(units)) {
+          if (pair_event && pair.first > pair.second) {
+            continue;
+          }
+          int tier = ExpectedTier(units[pair.first], units[pair.second],
+                                  bounds);
+          CHECK_EQ(aoi->GetTier(pair.first, pair.second), tier);
+          CHECK_EQ(tiers[pair], tier);
+        }
+        CHECK_EQ(aoi->GetTier(1, 1), -1);
+        CHECK_EQ(tier_errors, 0);
+        CHECK_EQ(log.errors, 0);
+      }
+    }
+  }
+}
+
+TEST(TierOfUnwatchedIsNegative) {
+  for (ModelKind kind : kAllModels) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kind, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    std::vector<int> events;
+    aoi->SetRangeTiers({10}, [&events](int, int, int tier) {
+      events.push_back(tier);
+    });
+    aoi->AddUnit(1, 100, 100, AOI::kWatcher, 30);
+    aoi->AddUnit(2, 105, 100, AOI::kMarker, 0);
+    CHECK_EQ(aoi->GetTier(1, 2), 0);
+    CHECK_EQ(aoi->GetTier(2, 1), -1);
+    aoi->UpdateUnit(2, 120, 100);
+    CHECK_EQ(aoi->GetTier(1, 2), 1);
+    aoi->UpdateUnit(2, 140, 100);
+    CHECK_EQ(aoi->GetTier(1, 2), -1);
+    CHECK((events == std::vector<int>{0, 1}));
+  }
+}
@@ -0,0 +1,67 @@
+#include "tests/test_util.h"
+#include "tower_aoi/tower_aoi.h"
+
+TEST(UnboundedTowersMatchBruteForce) {
+  EventLog log;
+  TowerAOI aoi(256, 256, 30, log.Enter(), log.Leave(), true);
+  std::map<int, TestUnit> units;
+  std::mt19937 rng(30);
+  std::uniform_real_distribution<float> position(-2000, 2000);
+  std::uniform_real_distribution<float> delta(-60, 60);
+  for (int i = 0; i < 3000; ++i) {
+    int op = rng() % 10;
+    if (units.empty() || 0 == op) {
+      int id = units.empty() ? 1 : units.rbegin()->first + 1;
+      TestUnit unit{position(rng), position(rng),
+                    static_cast<int>(1 + rng() % 3),
+                    static_cast<float>(rng() % 90), AOI::kAllMask, 0};
+      aoi.AddUnit(id, unit.x, unit.y, unit.flags, unit.range);
+      units[id] = unit;
+      continue;
+    }
+    auto it = units.begin();
+    std::advance(it, rng() % units.size());
+    if (1 == op) {
+      aoi.RemoveUnit(it->first);
+      units.erase(it);
+    } else {
+      it->second.x += delta(rng);
+      it->second.y += delta(rng);
+      aoi.UpdateUnit(it->first, it->second.x, it->second.y);
+    }
+  }
+  CHECK(SubscribedPairs(aoi, units) == ExpectedPairs(units));
+  CHECK(log.pairs == ExpectedPairs(units));
+  CHECK_EQ(log.errors, 0);
+}
+
+TEST(HugeCoordinatesAreClamped) {
+  EventLog log;
+  TowerAOI aoi(256, 256, 30, log.Enter(), log.Leave(), true);
+  aoi.AddUnit(1, 1e10f, 1e10f);
+  aoi.AddUnit(2, -1e10f, -1e10f);
+  // Queries and ranges far beyond the valid cells are clamped to them
+  CHECK_EQ(aoi.CountInRange(0, 0, 1e30f, 0), 2u);
+  AOI::Neighbor neighbors[2];
+  CHECK_EQ(aoi.FindKNearest(1e30f, 1e30f, 0, AOI::kAllMask, 2, INFINITY,
+                            neighbors),
+           2u);
+  CHECK_EQ(neighbors[0].id, 1);
+  aoi.AddUnit(3, 0, 0, AOI::kWatcher, 1e30f, AOI::kAllMask, 0);
+  CHECK(log.pairs.count({3, 1}) && log.pairs.count({3, 2}));
+  CHECK_EQ(log.errors, 0);
+}
+
+TEST(TowersFarApartStaySeparate) {
+  EventLog log;
+  TowerAOI aoi(256, 256, 30, log.Enter(), log.Leave(), true);
+  // Cells far beyond the map are stored apart, only near units meet
+  aoi.AddUnit(1, -1e6f, -1e6f);
+  aoi.AddUnit(2, 1e6f, 1e6f);
+  aoi.AddUnit(3, -1e6f + 10, -1e6f + 10);
+  CHECK((log.pairs == std::set<std::pair<int, int>>{{1, 3}, {3, 1}}));
+  aoi.RemoveUnit(3);
+  aoi.UpdateUnit(2, -1e6f + 5, -1e6f);
+  CHECK((log.pairs == std::set<std::pair<int, int>>{{1, 2}, {2, 1}}));
+  CHECK_EQ(log.errors, 0);
+}
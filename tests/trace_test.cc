@@ -0,0 +1,238 @@
+#include "tests/test_util.h"
+#include "trace/trace.h"
+
+static TraceRecord MakeRecord(TraceRecord::Op op, AOI::UnitID id = 0,
+                              float x = 0, float y = 0, int flags = 0,
+                              float range = 0, uint32_t mask = 0,
+                              int layer = 0) {
+  return TraceRecord{op, id, x, y, flags, range, mask, layer, false, 0, 0, {}};
+}
+
+TEST(TraceRoundTrip) {
+  std::string path = TempPath("trace.aoit");
+  std::unique_ptr<AOI> aoi =
+      NewModel(kTowerModel, 512, 256, 30, [](int, int) {}, [](int, int) {});
+  std::vector<TraceRecord> expected;
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+    CHECK(recorder.IsOpen());
+    std::mt19937 rng(32);
+    std::uniform_real_distribution<float> position(0, 256);
+    auto add = [&](int id, float x, float y, int flags, float range,
+                   uint32_t mask, int layer) {
+      recorder.AddUnit(id, x, y, flags, range, mask, layer);
+      expected.push_back(
+          MakeRecord(TraceRecord::kAdd, id, x, y, flags, range, mask, layer));
+    };
+    add(1, 0, 0, AOI::kWatcher, 45.5f, 3, -2);
+    add(-7, 256, 256, AOI::kMarker, 0, AOI::kAllMask, 1 << 20);
+    for (int tick = 0; tick < 10; ++tick) {
+      recorder.BeginTick();
+      expected.push_back(MakeRecord(TraceRecord::kBeginTick));
+      for (int id : {1, -7}) {
+        float x = position(rng);
+        float y = position(rng);
+        recorder.UpdateUnit(id, x, y);
+        expected.push_back(MakeRecord(TraceRecord::kUpdate, id, x, y));
+      }
+      recorder.FindNearbyUnit(1, 12.25f);
+      expected.push_back(MakeRecord(TraceRecord::kQuery, 1, 0, 0, 0, 12.25f));
+      recorder.EndTick();
+      expected.push_back(MakeRecord(TraceRecord::kEndTick));
+    }
+    recorder.RemoveUnit(-7);
+    expected.push_back(MakeRecord(TraceRecord::kRemove, -7));
+  }
+
+  TraceReader reader(path.c_str());
+  CHECK(reader.IsOpen());
+  CHECK_EQ(reader.header().width, 512.0f);
+  CHECK_EQ(reader.header().height, 256.0f);
+  CHECK_EQ(reader.header().visible_range, 30.0f);
+  for (int pass = 0; pass < 2; ++pass) {
+    reader.Rewind();
+    TraceRecord record;
+    size_t i = 0;
+    for (; reader.Next(&record) && i < expected.size(); ++i) {
+      const TraceRecord& want = expected[i];
+      CHECK_EQ(record.op, want.op);
+      if (TraceRecord::kBeginTick == want.op ||
+          TraceRecord::kEndTick == want.op) {
+        continue;
+      }
+      CHECK_EQ(record.id, want.id);
+      if (TraceRecord::kAdd == want.op || TraceRecord::kUpdate == want.op) {
+        CHECK_EQ(record.x, want.x);
+        CHECK_EQ(record.y, want.y);
+      }
+      if (TraceRecord::kAdd == want.op) {
+        CHECK_EQ(record.flags, want.flags);
+        CHECK_EQ(record.mask, want.mask);
+        CHECK_EQ(record.layer, want.layer);
+      }
+      if (TraceRecord::kAdd == want.op || TraceRecord::kQuery == want.op) {
+        CHECK_EQ(record.range, want.range);
+      }
+    }
+    CHECK_EQ(i, expected.size());
+    CHECK(reader.AtEnd());
+  }
+  unlink(path.c_str());
+}
+
+TEST(TruncatedTraceIsNotAtEnd) {
+  std::string path = TempPath("truncated.aoit");
+  std::unique_ptr<AOI> aoi =
+      NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+    recorder.AddUnit(1, 100.5f, 200.25f, AOI::kWatcher, 30, 1, 0);
+  }
+  FILE* fp = fopen(path.c_str(), "rb");
+  std::vector<char> data(1 << 10);
+  data.resize(fread(data.data(), 1, data.size(), fp));
+  fclose(fp);
+  fp = fopen(path.c_str(), "wb");
+  fwrite(data.data(), 1, data.size() - 2, fp);
+  fclose(fp);
+
+  TraceReader reader(path.c_str());
+  CHECK(reader.IsOpen());
+  TraceRecord record;
+  CHECK(!reader.Next(&record));
+  CHECK(!reader.AtEnd());
+  unlink(path.c_str());
+}
+
+TEST(TraceHeaderRecordsModes) {
+  std::string path = TempPath("modes.aoit");
+  std::unique_ptr<AOI> aoi =
+      NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+    recorder.SetPairEvent(true);
+    recorder.AddUnit(1, 100, 100);
+    recorder.AddUnit(2, 110, 100);
+  }
+  {
+    TraceReader reader(path.c_str());
+    CHECK(reader.IsOpen());
+    CHECK_EQ(reader.header().modes, kTracePairEvent);
+    TraceRecord record;
+    CHECK(reader.Next(&record) && reader.Next(&record));
+    CHECK(reader.AtEnd());
+  }
+
+  // Modes set on the AOI before recording are taken from it
+  aoi = NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+  aoi->SetPairEvent(true);
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+  }
+  TraceReader reader(path.c_str());
+  CHECK_EQ(reader.header().modes, kTracePairEvent);
+  unlink(path.c_str());
+}
+
+TEST(DeferredMovesAreRecorded) {
+  std::string path = TempPath("deferred.aoit");
+  std::unique_ptr<AOI> aoi =
+      NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+  aoi->SetDeferUpdates(true);
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+    recorder.AddUnit(1, 100, 100);
+    recorder.AddUnit(2, 200, 200);
+    recorder.UpdateUnit(1, 150, 150);
+    recorder.UpdateUnit(2, 300, 300);
+    AOI::UpdateBudget budget;
+    budget.max_units = 5;
+    budget.max_delay = 3;
+    CHECK_EQ(recorder.ProcessUpdates(budget), 2u);
+    recorder.SetDeferUpdates(false);
+  }
+
+  TraceReader reader(path.c_str());
+  CHECK_EQ(reader.header().modes, kTraceDeferUpdates);
+  TraceRecord record;
+  for (int i = 0; i < 4; ++i) {
+    CHECK(reader.Next(&record));
+  }
+  CHECK(reader.Next(&record));
+  CHECK_EQ(record.op, TraceRecord::kProcessUpdates);
+  CHECK_EQ(record.max_units, 2u);
+  CHECK_EQ(record.max_delay, 3u);
+  CHECK(reader.Next(&record));
+  CHECK_EQ(record.op, TraceRecord::kSetDeferUpdates);
+  CHECK(!record.enabled);
+  CHECK(!reader.Next(&record));
+  CHECK(reader.AtEnd());
+  unlink(path.c_str());
+}
+
+TEST(RangeTiersAreRecorded) {
+  std::string path = TempPath("tiers.aoit");
+  const std::vector<float> bounds = {10, 20.5f};
+  for (bool preset : {false, true}) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    if (preset) {
+      aoi->SetRangeTiers(bounds, [](int, int, int) {});
+    }
+    {
+      AOIRecorder recorder(aoi.get(), path.c_str());
+      if (!preset) {
+        recorder.SetRangeTiers(bounds, [](int, int, int) {});
+      }
+      recorder.AddUnit(1, 100, 100);
+    }
+
+    TraceReader reader(path.c_str());
+    CHECK_EQ(reader.header().modes, kTraceRangeTiers);
+    TraceRecord record;
+    CHECK(reader.Next(&record));
+    CHECK_EQ(record.op, TraceRecord::kSetRangeTiers);
+    CHECK(record.bounds == bounds);
+    CHECK(reader.Next(&record));
+    CHECK_EQ(record.op, TraceRecord::kAdd);
+    CHECK(!reader.Next(&record));
+    CHECK(reader.AtEnd());
+  }
+  unlink(path.c_str());
+}
+
+TEST(LargeRangeIsRecorded) {
+  std::string path = TempPath("large.aoit");
+  for (bool preset : {false, true}) {
+    std::unique_ptr<AOI> aoi =
+        NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+    if (preset) {
+      aoi->SetLargeRange(50);
+    }
+    {
+      AOIRecorder recorder(aoi.get(), path.c_str());
+      if (!preset) {
+        recorder.SetLargeRange(50);
+      }
+    }
+
+    TraceReader reader(path.c_str());
+    CHECK_EQ(reader.header().modes, kTraceLargeRange);
+    TraceRecord record;
+    CHECK(reader.Next(&record));
+    CHECK_EQ(record.op, TraceRecord::kSetLargeRange);
+    CHECK_EQ(record.range, 50.0f);
+    CHECK(!reader.Next(&record));
+    CHECK(reader.AtEnd());
+  }
+
+  // The default large range is not recorded
+  std::unique_ptr<AOI> aoi =
+      NewModel(kTowerModel, 512, 512, 30, [](int, int) {}, [](int, int) {});
+  {
+    AOIRecorder recorder(aoi.get(), path.c_str());
+  }
+  TraceReader reader(path.c_str());
+  CHECK_EQ(reader.header().modes, 0u);
+  unlink(path.c_str());
+}
@@ -1,107 +1,574 @@
+#include <algorithm>
+#include <climits>
 #include <cmath>
 
 #include "tower_aoi/tower_aoi.h"
 
+const size_t kInitTableCapacity = 64;
+const size_t kMaxFreeTowers = 64;
+// Rows and columns are kept within this bound, so that adding a span of
+// cells to them never overflows
+const int kMaxCell = 1 << 29;
+
 struct TowerAOI::Tower {
   AOI::UnitSet unit_set;  // units in same grid
 };
 
+// Open addressing hash table from cell to tower, with linear probing.
+// Only occupied towers are stored, so memory scales with the population
+// rather than the map area
+class TowerAOI::TowerTable {
+ public:
+  struct Key {
+    bool operator==(const Key& other) const {
+      return layer == other.layer && row == other.row && col == other.col;
+    }
+
+    int layer;
+    int row;
+    int col;
+  };
+
+  TowerTable() : size_(0), slots_(kInitTableCapacity) {}
+
+  ~TowerTable() {
+    for (auto& slot : slots_) {
+      delete slot.tower;
+    }
+    for (auto tower : free_towers_) {
+      delete tower;
+    }
+  }
+
+  TowerTable(const TowerTable&) = delete;
+  TowerTable(TowerTable&&) = delete;
+  TowerTable& operator=(const TowerTable&) = delete;
+  TowerTable& operator=(TowerTable&&) = delete;
+
+  Tower* Find(const Key& key) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      const Slot& slot = slots_[i];
+      if (nullptr == slot.tower || slot.key == key) {
+        return slot.tower;
+      }
+    }
+  }
+
+  Tower* FindOrCreate(const Key& key) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      Rehash(slots_.size() * 2);
+    }
+
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(key) & mask;
+    while (nullptr != slots_[i].tower) {
+      if (slots_[i].key == key) {
+        return slots_[i].tower;
+      }
+      i = (i + 1) & mask;
+    }
+
+    Tower* tower;
+    if (free_towers_.empty()) {
+      tower = new Tower();
+    } else {
+      tower = free_towers_.back();
+      free_towers_.pop_back();
+    }
+    slots_[i].key = key;
+    slots_[i].tower = tower;
+    ++size_;
+    return tower;
+  }
+
+  // Remove the tower of key, the tower may be kept for reuse. The table
+  // shrinks when it becomes sparse
+  void Erase(const Key& key) {
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(key) & mask;
+    while (nullptr == slots_[i].tower || !(slots_[i].key == key)) {
+      i = (i + 1) & mask;
+    }
+    Release(slots_[i].tower);
+    slots_[i].tower = nullptr;
+    --size_;
+
+    // Shift back the following slots of the probe sequence to fill the hole
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; nullptr != slots_[j].tower;
+         j = (j + 1) & mask) {
+      size_t home = Hash(slots_[j].key) & mask;
+      if (((j - home) & mask) >= ((j - hole) & mask)) {
+        slots_[hole] = slots_[j];
+        slots_[j].tower = nullptr;
+        hole = j;
+      }
+    }
+
+    if (slots_.size() > kInitTableCapacity && size_ * 8 < slots_.size()) {
+      Rehash(slots_.size() / 2);
+    }
+  }
+
+  // Grow the table to hold count towers without rehashing
+  void Reserve(size_t count) {
+    size_t capacity = slots_.size();
+    while (count * 2 > capacity) {
+      capacity *= 2;
+    }
+    if (capacity != slots_.size()) {
+      Rehash(capacity);
+    }
+  }
+
+  // Remove all towers and shrink the table to its initial capacity
+  void Clear() {
+    for (auto& slot : slots_) {
+      if (nullptr != slot.tower) {
+        slot.tower->unit_set.clear();
+        Release(slot.tower);
+      }
+    }
+    std::vector<Slot>(kInitTableCapacity).swap(slots_);
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+
+  template <class Function>
+  void Foreach(const Function& func) const {
+    for (const auto& slot : slots_) {
+      if (nullptr != slot.tower) {
+        func(slot.key, slot.tower);
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    Slot() : key{0, 0, 0}, tower(nullptr) {}
+
+    Key key;
+    Tower* tower;
+  };
+
+  static size_t Hash(const Key& key) {
+    uint64_t h = static_cast<uint32_t>(key.row) * 0x9E3779B97F4A7C15ULL ^
+                 static_cast<uint32_t>(key.col) * 0xC2B2AE3D27D4EB4FULL ^
+                 static_cast<uint32_t>(key.layer) * 0x165667B19E3779F9ULL;
+    return static_cast<size_t>(h ^ (h >> 29));
+  }
+
+  // Keep an empty tower for reuse unless there are enough spares
+  void Release(Tower* tower) {
+    if (free_towers_.size() < kMaxFreeTowers) {
+      free_towers_.push_back(tower);
+    } else {
+      delete tower;
+    }
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<Slot> slots(capacity);
+    slots.swap(slots_);
+    size_t mask = capacity - 1;
+    for (const auto& slot : slots) {
+      if (nullptr == slot.tower) {
+        continue;
+      }
+      size_t i = Hash(slot.key) & mask;
+      while (nullptr != slots_[i].tower) {
+        i = (i + 1) & mask;
+      }
+      slots_[i] = slot;
+    }
+  }
+
+  size_t size_;
+  std::vector<Slot> slots_;  // Capacity is always a power of 2
+  std::vector<Tower*> free_towers_;
+};
+
 TowerAOI::TowerAOI(float width, float height, float visible_range,
                    const AOI::Callback& enter_callback,
-                   const AOI::Callback& leave_callback)
+                   const AOI::Callback& leave_callback, bool unbounded)
     : AOI(width, height, visible_range, enter_callback, leave_callback),
       rows_(ceil(height / visible_range)),
-      cols_(ceil(width / visible_range)) {
-  towers_ = new Tower*[rows_];
-  for (int i = 0; i < rows_; ++i) {
-    towers_[i] = new Tower[cols_];
-  }
-}
+      cols_(ceil(width / visible_range)),
+      unbounded_(unbounded),
+      towers_(new TowerTable()) {}
 
 TowerAOI::~TowerAOI() {
-  std::vector<UnitID> unit_ids = get_unit_ids();
-  for (auto id : unit_ids) {
-    RemoveUnit(id);
-  }
-
-  for (int i = 0; i < rows_; ++i) {
-    delete[] towers_[i];
-  }
-  delete[] towers_;
+  Clear();
+  delete towers_;
 }
 
-void TowerAOI::AddUnit(UnitID id, float x, float y) {
+void TowerAOI::AddUnit(UnitID id, float x, float y, int flags,
+                       float range, uint32_t mask, int layer) {
+  AOI_STAT(ScopedLatency latency(&stats_.add_latency));
   ValidatetUnitID(id);
   ValidatePosition(x, y);
 
   AOI::Unit* unit = NewUnit(id, x, y);
-  int row, col;
-  CalculateRowCol(unit, &row, &col);
-  towers_[row][col].unit_set.insert(unit);
+  unit->flags = flags;
+  unit->range = range;
+  unit->mask = mask;
+  unit->layer = layer;
+  InsertToTower(unit);
 
   OnAddUnit(unit);
 }
 
 void TowerAOI::UpdateUnit(UnitID id, float x, float y) {
   ValidatePosition(x, y);
+  if (DeferUpdate(id, x, y)) {
+    return;
+  }
+  AOI_STAT(ScopedLatency latency(&stats_.update_latency));
   AOI::Unit* unit = get_unit(id);
 
   int old_row, old_col, new_row, new_col;
-  CalculateRowCol(unit, &old_row, &old_col);
-  unit->x = x;
-  unit->y = y;
-  CalculateRowCol(unit, &new_row, &new_col);
-
-  towers_[old_row][old_col].unit_set.erase(unit);
-  towers_[new_row][new_col].unit_set.insert(unit);
+  CalculateRowCol(unit->x, unit->y, &old_row, &old_col);
+  CalculateRowCol(x, y, &new_row, &new_col);
+  if (old_row != new_row || old_col != new_col) {
+    EraseFromTower(unit);
+    unit->x = x;
+    unit->y = y;
+    InsertToTower(unit);
+  } else {
+    unit->x = x;
+    unit->y = y;
+  }
 
   OnUpdateUnit(unit);
 }
 
 void TowerAOI::RemoveUnit(UnitID id) {
+  AOI_STAT(ScopedLatency latency(&stats_.remove_latency));
   AOI::Unit* unit = get_unit(id);
-  int row, col;
-  CalculateRowCol(unit, &row, &col);
-  towers_[row][col].unit_set.erase(unit);
+  EraseFromTower(unit);
   OnRemoveUnit(unit);
 }
 
-inline void TowerAOI::CalculateRowCol(const AOI::Unit* unit, int* row,
+inline void TowerAOI::CalculateRowCol(float x, float y, int* row,
                                       int* col) const {
   float visible_range = get_visible_range();
-  *row = std::clamp(static_cast<int>(floor(unit->y / visible_range)), 0,
-                    rows_ - 1);
-  *col = std::clamp(static_cast<int>(floor(unit->x / visible_range)), 0,
-                    cols_ - 1);
+  float max_cell = kMaxCell;
+  *row = static_cast<int>(
+      std::clamp(std::floor(y / visible_range), -max_cell, max_cell));
+  *col = static_cast<int>(
+      std::clamp(std::floor(x / visible_range), -max_cell, max_cell));
+  if (!unbounded_) {
+    *row = std::clamp(*row, 0, rows_ - 1);
+    *col = std::clamp(*col, 0, cols_ - 1);
+  }
+}
+
+void TowerAOI::InsertToTower(AOI::Unit* unit) {
+  int row, col;
+  CalculateRowCol(unit->x, unit->y, &row, &col);
+  towers_->FindOrCreate({unit->layer, row, col})->unit_set.insert(unit);
+}
+
+void TowerAOI::EraseFromTower(AOI::Unit* unit) {
+  int row, col;
+  CalculateRowCol(unit->x, unit->y, &row, &col);
+  TowerTable::Key key{unit->layer, row, col};
+  Tower* tower = towers_->Find(key);
+  tower->unit_set.erase(unit);
+  if (tower->unit_set.empty()) {
+    towers_->Erase(key);
+  }
+}
+
+void TowerAOI::BuildIndex(const std::vector<AOI::Unit*>& units) {
+  // Sort units by tower, so that every tower is created once and filled in
+  // one go
+  typedef std::pair<TowerTable::Key, AOI::Unit*> KeyedUnit;
+  std::vector<KeyedUnit> keyed_units(units.size());
+  for (size_t i = 0; i < units.size(); ++i) {
+    AOI::Unit* unit = units[i];
+    ValidatePosition(unit->x, unit->y);
+    int row, col;
+    CalculateRowCol(unit->x, unit->y, &row, &col);
+    keyed_units[i] = {{unit->layer, row, col}, unit};
+  }
+  std::sort(keyed_units.begin(), keyed_units.end(),
+            [](const KeyedUnit& a, const KeyedUnit& b) {
+              const TowerTable::Key& k1 = a.first;
+              const TowerTable::Key& k2 = b.first;
+              if (k1.layer != k2.layer) {
+                return k1.layer < k2.layer;
+              }
+              return k1.row != k2.row ? k1.row < k2.row : k1.col < k2.col;
+            });
+
+  size_t tower_count = 0;
+  for (size_t i = 0; i < keyed_units.size(); ++i) {
+    if (0 == i || !(keyed_units[i].first == keyed_units[i - 1].first)) {
+      ++tower_count;
+    }
+  }
+  towers_->Reserve(towers_->size() + tower_count);
+
+  size_t begin = 0;
+  while (begin < keyed_units.size()) {
+    size_t end = begin + 1;
+    while (end < keyed_units.size() &&
+           keyed_units[end].first == keyed_units[begin].first) {
+      ++end;
+    }
+    AOI::UnitSet& unit_set =
+        towers_->FindOrCreate(keyed_units[begin].first)->unit_set;
+    unit_set.reserve(unit_set.size() + end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      unit_set.insert(keyed_units[i].second);
+    }
+    begin = end;
+  }
+}
+
+void TowerAOI::ClearIndex() { towers_->Clear(); }
+
+bool TowerAOI::IsValidPosition(float x, float y) const {
+  if (unbounded_) {
+    float visible_range = get_visible_range();
+    return fabs(x / visible_range) < kMaxCell &&
+           fabs(y / visible_range) < kMaxCell;
+  }
+  return AOI::IsValidPosition(x, y);
+}
+
+template <class Function>
+void TowerAOI::ForeachTower(int layer, int start_row, int start_col,
+                            int end_row, int end_col,
+                            const Function& func) const {
+  // Visit the occupied towers directly if they are fewer than the cells in
+  // range, which happens for large ranges on sparse maps
+  int64_t cells =
+      (static_cast<int64_t>(end_row) - start_row + 1) *
+      (static_cast<int64_t>(end_col) - start_col + 1);
+  if (cells > static_cast<int64_t>(towers_->size())) {
+    towers_->Foreach([&](const TowerTable::Key& key, const Tower* tower) {
+      if (key.layer == layer && key.row >= start_row && key.row <= end_row &&
+          key.col >= start_col && key.col <= end_col) {
+        func(key.row, key.col, tower);
+      }
+    });
+  } else {
+    for (int i = start_row; i <= end_row; ++i) {
+      for (int j = start_col; j <= end_col; ++j) {
+        const Tower* tower = towers_->Find({layer, i, j});
+        if (nullptr != tower) {
+          func(i, j, tower);
+        }
+      }
+    }
+  }
 }
 
 AOI::UnitSet TowerAOI::FindNearbyUnit(const AOI::Unit* unit,
                                       float range) const {
   int row, col;
-  CalculateRowCol(unit, &row, &col);
-  int span = ceil(range / get_visible_range());
-  int start_row = std::max(row - span, 0);
-  int start_col = std::max(col - span, 0);
-  int end_row = std::min(row + span, rows_ - 1);
-  int end_col = std::min(col + span, cols_ - 1);
+  CalculateRowCol(unit->x, unit->y, &row, &col);
+  int span = std::min(std::ceil(range / get_visible_range()),
+                      static_cast<float>(kMaxCell));
+  int start_row = row - span;
+  int start_col = col - span;
+  int end_row = row + span;
+  int end_col = col + span;
+  if (!unbounded_) {
+    start_row = std::max(start_row, 0);
+    start_col = std::max(start_col, 0);
+    end_row = std::min(end_row, rows_ - 1);
+    end_col = std::min(end_col, cols_ - 1);
+  }
+
+  AOI_STAT(++stats_.searches);
   AOI::UnitSet res_set;
-  for (int i = start_row; i <= end_row; ++i) {
-    for (int j = start_col; j <= end_col; ++j) {
-      const AOI::UnitSet& unit_set = towers_[i][j].unit_set;
-      for (auto other : unit_set) {
-        if (fabs(unit->x - other->x) <= range &&
-            fabs(unit->y - other->y) <= range) {
-          res_set.insert(other);
-        }
+  auto scan = [&](const Tower* tower) {
+    AOI_STAT(++stats_.nodes_visited);
+    AOI_STAT(stats_.units_scanned += tower->unit_set.size());
+    for (auto other : tower->unit_set) {
+      if (0 != (unit->mask & other->mask) &&
+          fabs(unit->x - other->x) <= range &&
+          fabs(unit->y - other->y) <= range) {
+        res_set.insert(other);
       }
     }
-  }
+  };
+
+  ForeachTower(unit->layer, start_row, start_col, end_row, end_col,
+               [&scan](int, int, const Tower* tower) { scan(tower); });
   res_set.erase(const_cast<AOI::Unit*>(unit));
   return res_set;
 }
 
+size_t TowerAOI::FindKNearest(UnitID id, size_t k, float max_range,
+                              Neighbor* result) const {
+  const AOI::Unit* unit = get_unit(id);
+  NearestHeap heap(k, max_range);
+  FindKNearest(unit->x, unit->y, unit->layer, unit->mask, unit, heap);
+  return heap.Output(result);
+}
+
+size_t TowerAOI::FindKNearest(float x, float y, int layer, uint32_t mask,
+                              size_t k, float max_range,
+                              Neighbor* result) const {
+  NearestHeap heap(k, max_range);
+  FindKNearest(x, y, layer, mask, nullptr, heap);
+  return heap.Output(result);
+}
+
+void TowerAOI::FindKNearest(float x, float y, int layer, uint32_t mask,
+                            const AOI::Unit* exclude,
+                            NearestHeap& heap) const {
+  AOI_STAT(++stats_.searches);
+  auto scan = [&](const Tower* tower) {
+    AOI_STAT(++stats_.nodes_visited);
+    AOI_STAT(stats_.units_scanned += tower->unit_set.size());
+    for (auto other : tower->unit_set) {
+      if (other != exclude && 0 != (mask & other->mask)) {
+        float dx = other->x - x;
+        float dy = other->y - y;
+        heap.Push(other, dx * dx + dy * dy);
+      }
+    }
+  };
+
+  // Visit rings of towers around the tower of (x, y), until the next ring
+  // is farther than the k-th unit found
+  float visible_range = get_visible_range();
+  int row, col;
+  CalculateRowCol(x, y, &row, &col);
+  int max_ring = unbounded_ ? INT_MAX : std::max(rows_, cols_);
+  for (int ring = 0; ring <= max_ring; ++ring) {
+    if (ring > 0) {
+      // Distance from (x, y) to the outside of the previous rings
+      float distance = std::min(
+          std::min(x - (col - ring + 1) * visible_range,
+                   (col + ring) * visible_range - x),
+          std::min(y - (row - ring + 1) * visible_range,
+                   (row + ring) * visible_range - y));
+      distance = std::max(distance, 0.0f);
+      if (distance * distance > heap.bound()) {
+        return;
+      }
+    }
+
+    // Rings grow larger than the occupied towers on sparse maps, scan the
+    // towers outside the previous rings at once
+    if (8 * static_cast<size_t>(ring) > towers_->size()) {
+      towers_->Foreach([&](const TowerTable::Key& key, const Tower* tower) {
+        if (key.layer == layer &&
+            std::max(std::abs(key.row - row), std::abs(key.col - col)) >=
+                ring) {
+          scan(tower);
+        }
+      });
+      return;
+    }
+
+    for (int i = row - ring; i <= row + ring; ++i) {
+      // Only the first and last rows are walked entirely
+      int step = i == row - ring || i == row + ring ? 1 : 2 * ring;
+      for (int j = col - ring; j <= col + ring; j += std::max(step, 1)) {
+        const Tower* tower = towers_->Find({layer, i, j});
+        if (nullptr != tower) {
+          scan(tower);
+        }
+      }
+    }
+  }
+}
+
+void TowerAOI::CollectInShape(const AOIShape& shape, int layer,
+                              uint32_t mask,
+                              ShapeCandidates* candidates) const {
+  float x1, y1, x2, y2;
+  shape.GetBounds(&x1, &y1, &x2, &y2);
+  int start_row, start_col, end_row, end_col;
+  CalculateRowCol(x1, y1, &start_row, &start_col);
+  CalculateRowCol(x2, y2, &end_row, &end_col);
+
+  AOI_STAT(++stats_.searches);
+  float visible_range = get_visible_range();
+  // Cells are padded so that rounding never drops the units on their edges
+  float padding = visible_range * 1e-4f;
+  auto scan = [&](int row, int col, const Tower* tower) {
+    if (!shape.Intersects(col * visible_range - padding,
+                          row * visible_range - padding,
+                          (col + 1) * visible_range + padding,
+                          (row + 1) * visible_range + padding)) {
+      return;
+    }
+    AOI_STAT(++stats_.nodes_visited);
+    AOI_STAT(stats_.units_scanned += tower->unit_set.size());
+    for (auto other : tower->unit_set) {
+      if (0 != (mask & other->mask)) {
+        candidates->Push(other);
+      }
+    }
+  };
+
+  ForeachTower(layer, start_row, start_col, end_row, end_col, scan);
+}
+
+size_t TowerAOI::CountInBox(float x1, float y1, float x2, float y2,
+                            int layer) const {
+  int start_row, start_col, end_row, end_col;
+  CalculateRowCol(x1, y1, &start_row, &start_col);
+  CalculateRowCol(x2, y2, &end_row, &end_col);
+
+  AOI_STAT(++stats_.searches);
+  float visible_range = get_visible_range();
+  float padding = visible_range * 1e-4f;
+  size_t count = 0;
+  auto count_tower = [&](int row, int col, const Tower* tower) {
+    AOI_STAT(++stats_.nodes_visited);
+    // Towers inside the box are counted as a whole
+    if (col * visible_range - padding >= x1 &&
+        (col + 1) * visible_range + padding <= x2 &&
+        row * visible_range - padding >= y1 &&
+        (row + 1) * visible_range + padding <= y2) {
+      count += tower->unit_set.size();
+      return;
+    }
+    AOI_STAT(stats_.units_scanned += tower->unit_set.size());
+    for (auto other : tower->unit_set) {
+      count += other->x >= x1 && other->x <= x2 && other->y >= y1 &&
+               other->y <= y2;
+    }
+  };
+  ForeachTower(layer, start_row, start_col, end_row, end_col, count_tower);
+  return count;
+}
+
+void TowerAOI::FillDensityGrid(const GridLayout& grid, int layer,
+                               uint32_t* counts) const {
+  float visible_range = get_visible_range();
+  float padding = visible_range * 1e-4f;
+  towers_->Foreach([&](const TowerTable::Key& key, const Tower* tower) {
+    if (key.layer != layer) {
+      return;
+    }
+    // Towers inside a cell are counted as a whole
+    int row = grid.Row(key.row * visible_range + padding);
+    int col = grid.Col(key.col * visible_range + padding);
+    if (row == grid.Row((key.row + 1) * visible_range - padding) &&
+        col == grid.Col((key.col + 1) * visible_range - padding)) {
+      counts[grid.Index(row, col)] += tower->unit_set.size();
+      return;
+    }
+    for (auto unit : tower->unit_set) {
+      ++counts[grid.Index(grid.Row(unit->y), grid.Col(unit->x))];
+    }
+  });
+}
+
 AOI::Unit* TowerAOI::NewUnit(UnitID id, float x, float y) {
   return new AOI::Unit(id, x, y);
 }
 
-void TowerAOI::DeleteUnit(AOI::Unit* unit) { delete unit; }
\ No newline at end of file
+void TowerAOI::DeleteUnit(AOI::Unit* unit) { delete unit; }
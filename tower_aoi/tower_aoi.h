@@ -1,4 +1,3 @@
-
 #ifndef TOWER_AOI_H
 #define TOWER_AOI_H
 
@@ -7,29 +6,64 @@
 class TowerAOI : public AOI {
  private:
   struct Tower;
+  class TowerTable;
 
  public:
+  // If unbounded is true, units may be placed beyond width and height,
+  // including negative coordinates, up to 2^29 visible ranges away
   TowerAOI(float width, float height, float visible_range,
            const AOI::Callback& enter_callback,
-           const AOI::Callback& leave_callback);
+           const AOI::Callback& leave_callback, bool unbounded = false);
   ~TowerAOI() override;
 
-  void AddUnit(UnitID id, float x, float y) override;
+  using AOI::AddUnit;
+  void AddUnit(UnitID id, float x, float y, int flags, float range,
+               uint32_t mask, int layer) override;
   void UpdateUnit(UnitID id, float x, float y) override;
   void RemoveUnit(UnitID id) override;
+  using AOI::FindNearbyUnit;
+
+  // Find at most k units nearest to id within Euclidean max_range, which are
+  // in the same layer and match its mask, excluding id itself. They are
+  // written into result sorted by distance, and their count is returned
+  size_t FindKNearest(UnitID id, size_t k, float max_range,
+                      Neighbor* result) const;
+
+  // Find at most k units of layer which match mask nearest to (x, y)
+  size_t FindKNearest(float x, float y, int layer, uint32_t mask, size_t k,
+                      float max_range, Neighbor* result) const;
 
  protected:
   AOI::UnitSet FindNearbyUnit(const AOI::Unit* unit,
                               float range) const override;
+  void CollectInShape(const AOIShape& shape, int layer, uint32_t mask,
+                      ShapeCandidates* candidates) const override;
+  size_t CountInBox(float x1, float y1, float x2, float y2,
+                    int layer) const override;
+  void FillDensityGrid(const GridLayout& grid, int layer,
+                       uint32_t* counts) const override;
 
  private:
   AOI::Unit* NewUnit(UnitID id, float x, float y) override;
   void DeleteUnit(AOI::Unit* unit) override;
-  void CalculateRowCol(const AOI::Unit* unit, int* row, int* col) const;
+  void BuildIndex(const std::vector<AOI::Unit*>& units) override;
+  void ClearIndex() override;
+  bool IsValidPosition(float x, float y) const override;
+  void FindKNearest(float x, float y, int layer, uint32_t mask,
+                    const AOI::Unit* exclude, NearestHeap& heap) const;
+  // Call func(row, col, tower) for the occupied towers of layer within the
+  // given rows and columns
+  template <class Function>
+  void ForeachTower(int layer, int start_row, int start_col, int end_row,
+                    int end_col, const Function& func) const;
+  void CalculateRowCol(float x, float y, int* row, int* col) const;
+  void InsertToTower(AOI::Unit* unit);
+  void EraseFromTower(AOI::Unit* unit);
 
   const int rows_;
   const int cols_;
-  Tower** towers_;
+  const bool unbounded_;
+  TowerTable* towers_;  // Occupied towers of all layers
 };
 
 #endif  // TOWER_AOI_H
\ No newline at end of file
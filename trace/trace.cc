@@ -0,0 +1,385 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "trace/trace.h"
+
+const size_t kFlushSize = 64 * 1024;
+
+static uint32_t FloatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static float BitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Difference between the bits of two floats, as a signed integer
+static int64_t FloatDelta(float from, float to) {
+  return static_cast<int32_t>(FloatBits(to) - FloatBits(from));
+}
+
+static float ApplyFloatDelta(float from, int64_t delta) {
+  return BitsFloat(FloatBits(from) + static_cast<uint32_t>(delta));
+}
+
+AOIRecorder::AOIRecorder(AOI* aoi, const char* path)
+    : aoi_(aoi), fp_(fopen(path, "wb")) {
+  if (nullptr == fp_) {
+    return;
+  }
+
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kTraceMagic, sizeof(header_.magic));
+  header_.version = kTraceVersion;
+  header_.width = aoi->get_width();
+  header_.height = aoi->get_height();
+  header_.visible_range = aoi->get_visible_range();
+  header_.modes = (aoi->get_pair_event() ? kTracePairEvent : 0) |
+                  (aoi->get_defer_updates() ? kTraceDeferUpdates : 0);
+  WriteHeader();
+  if (aoi->IsTiered()) {
+    WriteRangeTiers(aoi->get_tier_bounds());
+  }
+  if (aoi->get_large_range() !=
+      AOI::DefaultLargeRange(aoi->get_visible_range())) {
+    WriteLargeRange(aoi->get_large_range());
+  }
+}
+
+AOIRecorder::~AOIRecorder() {
+  if (nullptr != fp_) {
+    Flush();
+    fclose(fp_);
+  }
+}
+
+void AOIRecorder::SetPairEvent(bool pair_event) {
+  aoi_->SetPairEvent(pair_event);
+  SetMode(kTracePairEvent, pair_event);
+}
+
+void AOIRecorder::SetRangeTiers(const std::vector<float>& bounds,
+                                AOI::TierCallback tier_callback) {
+  aoi_->SetRangeTiers(bounds, tier_callback);
+  WriteRangeTiers(bounds);
+}
+
+void AOIRecorder::SetLargeRange(float range) {
+  aoi_->SetLargeRange(range);
+  WriteLargeRange(range);
+}
+
+void AOIRecorder::AddUnit(AOI::UnitID id, float x, float y, int flags,
+                          float range, uint32_t mask, int layer) {
+  buffer_.push_back(TraceRecord::kAdd);
+  WriteInt(id);
+  WriteVarint(flags);
+  WriteFloat(range);
+  WriteVarint(mask);
+  WriteInt(layer);
+  WriteFloat(x);
+  WriteFloat(y);
+  positions_[id] = {x, y};
+  MaybeFlush();
+
+  aoi_->AddUnit(id, x, y, flags, range, mask, layer);
+}
+
+void AOIRecorder::UpdateUnit(AOI::UnitID id, float x, float y) {
+  auto& position = positions_[id];
+  buffer_.push_back(TraceRecord::kUpdate);
+  WriteInt(id);
+  WriteInt(FloatDelta(position.first, x));
+  WriteInt(FloatDelta(position.second, y));
+  position = {x, y};
+  MaybeFlush();
+
+  aoi_->UpdateUnit(id, x, y);
+}
+
+void AOIRecorder::RemoveUnit(AOI::UnitID id) {
+  buffer_.push_back(TraceRecord::kRemove);
+  WriteInt(id);
+  positions_.erase(id);
+  MaybeFlush();
+
+  aoi_->RemoveUnit(id);
+}
+
+std::unordered_set<int> AOIRecorder::FindNearbyUnit(AOI::UnitID id,
+                                                    float range) {
+  buffer_.push_back(TraceRecord::kQuery);
+  WriteInt(id);
+  WriteFloat(range);
+  MaybeFlush();
+
+  return aoi_->FindNearbyUnit(id, range);
+}
+
+void AOIRecorder::BeginTick() {
+  buffer_.push_back(TraceRecord::kBeginTick);
+  MaybeFlush();
+
+  aoi_->BeginTick();
+}
+
+void AOIRecorder::EndTick() {
+  buffer_.push_back(TraceRecord::kEndTick);
+  Flush();
+  aoi_->EndTick();
+}
+
+void AOIRecorder::SetDeferUpdates(bool defer_updates) {
+  buffer_.push_back(TraceRecord::kSetDeferUpdates);
+  WriteVarint(defer_updates);
+  MaybeFlush();
+
+  aoi_->SetDeferUpdates(defer_updates);
+}
+
+size_t AOIRecorder::ProcessUpdates(const AOI::UpdateBudget& budget) {
+  size_t moved = aoi_->ProcessUpdates(budget);
+  buffer_.push_back(TraceRecord::kProcessUpdates);
+  WriteVarint(moved);
+  WriteVarint(budget.max_delay);
+  MaybeFlush();
+  return moved;
+}
+
+void AOIRecorder::Flush() {
+  if (nullptr != fp_ && !buffer_.empty()) {
+    fwrite(buffer_.data(), 1, buffer_.size(), fp_);
+    fflush(fp_);
+  }
+  buffer_.clear();
+}
+
+void AOIRecorder::SetMode(uint32_t mode, bool enabled) {
+  header_.modes = enabled ? header_.modes | mode : header_.modes & ~mode;
+  WriteHeader();
+}
+
+void AOIRecorder::WriteRangeTiers(const std::vector<float>& bounds) {
+  buffer_.push_back(TraceRecord::kSetRangeTiers);
+  WriteVarint(bounds.size());
+  for (float bound : bounds) {
+    WriteFloat(bound);
+  }
+  SetMode(kTraceRangeTiers, true);
+}
+
+void AOIRecorder::WriteLargeRange(float range) {
+  buffer_.push_back(TraceRecord::kSetLargeRange);
+  WriteFloat(range);
+  SetMode(kTraceLargeRange, true);
+}
+
+void AOIRecorder::WriteHeader() {
+  if (nullptr != fp_) {
+    fseek(fp_, 0, SEEK_SET);
+    fwrite(&header_, sizeof(header_), 1, fp_);
+    fseek(fp_, 0, SEEK_END);
+  }
+}
+
+void AOIRecorder::MaybeFlush() {
+  if (buffer_.size() >= kFlushSize) {
+    Flush();
+  }
+}
+
+void AOIRecorder::WriteVarint(uint64_t value) {
+  while (value >= 0x80) {
+    buffer_.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  buffer_.push_back(static_cast<uint8_t>(value));
+}
+
+void AOIRecorder::WriteInt(int64_t value) {
+  // Zigzag encoding, so that small negative values stay short
+  WriteVarint((static_cast<uint64_t>(value) << 1) ^
+              static_cast<uint64_t>(value >> 63));
+}
+
+void AOIRecorder::WriteFloat(float value) {
+  uint32_t bits = FloatBits(value);
+  for (int i = 0; i < 4; ++i) {
+    buffer_.push_back(static_cast<uint8_t>(bits >> (i * 8)));
+  }
+}
+
+TraceReader::TraceReader(const char* path)
+    : data_(nullptr), size_(0), pos_(sizeof(TraceHeader)), corrupted_(false) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(TraceHeader)) {
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != data) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const uint8_t*>(data);
+      size_ = st.st_size;
+    }
+  }
+  close(fd);
+
+  if (nullptr != data_ &&
+      (memcmp(header().magic, kTraceMagic, sizeof(kTraceMagic)) != 0 ||
+       header().version != kTraceVersion)) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+    data_ = nullptr;
+  }
+}
+
+TraceReader::~TraceReader() {
+  if (nullptr != data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+}
+
+bool TraceReader::Next(TraceRecord* record) {
+  if (nullptr == data_ || pos_ >= size_ || corrupted_) {
+    return false;
+  }
+  if (!Decode(record)) {
+    corrupted_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool TraceReader::Decode(TraceRecord* record) {
+  record->op = static_cast<TraceRecord::Op>(data_[pos_++]);
+  int64_t id, value;
+  uint64_t uvalue;
+  switch (record->op) {
+    case TraceRecord::kAdd: {
+      if (!ReadInt(&id) || !ReadVarint(&uvalue)) {
+        return false;
+      }
+      record->id = static_cast<AOI::UnitID>(id);
+      record->flags = static_cast<int>(uvalue);
+      if (!ReadFloat(&record->range) || !ReadVarint(&uvalue)) {
+        return false;
+      }
+      record->mask = static_cast<uint32_t>(uvalue);
+      if (!ReadInt(&value) || !ReadFloat(&record->x) ||
+          !ReadFloat(&record->y)) {
+        return false;
+      }
+      record->layer = static_cast<int>(value);
+      positions_[record->id] = {record->x, record->y};
+      return true;
+    }
+    case TraceRecord::kUpdate: {
+      int64_t dx, dy;
+      if (!ReadInt(&id) || !ReadInt(&dx) || !ReadInt(&dy)) {
+        return false;
+      }
+      record->id = static_cast<AOI::UnitID>(id);
+      auto& position = positions_[record->id];
+      position.first = ApplyFloatDelta(position.first, dx);
+      position.second = ApplyFloatDelta(position.second, dy);
+      record->x = position.first;
+      record->y = position.second;
+      return true;
+    }
+    case TraceRecord::kRemove:
+      if (!ReadInt(&id)) {
+        return false;
+      }
+      record->id = static_cast<AOI::UnitID>(id);
+      positions_.erase(record->id);
+      return true;
+    case TraceRecord::kQuery:
+      if (!ReadInt(&id) || !ReadFloat(&record->range)) {
+        return false;
+      }
+      record->id = static_cast<AOI::UnitID>(id);
+      return true;
+    case TraceRecord::kBeginTick:
+    case TraceRecord::kEndTick:
+      return true;
+    case TraceRecord::kSetDeferUpdates:
+      if (!ReadVarint(&uvalue)) {
+        return false;
+      }
+      record->enabled = 0 != uvalue;
+      return true;
+    case TraceRecord::kProcessUpdates:
+      if (!ReadVarint(&uvalue) || !ReadVarint(&record->max_delay)) {
+        return false;
+      }
+      record->max_units = static_cast<size_t>(uvalue);
+      return true;
+    case TraceRecord::kSetLargeRange:
+      return ReadFloat(&record->range);
+    case TraceRecord::kSetRangeTiers:
+      // Every bound takes 4 bytes, which limits the count
+      if (!ReadVarint(&uvalue) || uvalue > (size_ - pos_) / 4) {
+        return false;
+      }
+      record->bounds.resize(uvalue);
+      for (float& bound : record->bounds) {
+        if (!ReadFloat(&bound)) {
+          return false;
+        }
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+void TraceReader::Rewind() {
+  pos_ = sizeof(TraceHeader);
+  corrupted_ = false;
+  positions_.clear();
+}
+
+bool TraceReader::ReadVarint(uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && pos_ < size_; shift += 7) {
+    uint8_t byte = data_[pos_++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TraceReader::ReadInt(int64_t* value) {
+  uint64_t zigzag;
+  if (!ReadVarint(&zigzag)) {
+    return false;
+  }
+  *value =
+      static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+  return true;
+}
+
+bool TraceReader::ReadFloat(float* value) {
+  if (pos_ + 4 > size_) {
+    return false;
+  }
+  uint32_t bits = 0;
+  for (int i = 0; i < 4; ++i) {
+    bits |= static_cast<uint32_t>(data_[pos_++]) << (i * 8);
+  }
+  *value = BitsFloat(bits);
+  return true;
+}
@@ -0,0 +1,169 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "aoi.h"
+
+// Binary trace of AOI operations.
+//
+// A trace starts with a TraceHeader, followed by records. Each record is an
+// op byte and its fields, integers are zigzag varints. Positions of updates
+// are the differences between the float bits of the new and the previous
+// position of the unit, which are small for small moves and decode exactly.
+//
+//   kAdd       id, flags, range(float), mask, layer, x(float), y(float)
+//   kUpdate    id, dx(bits), dy(bits)
+//   kRemove    id
+//   kQuery     id, range(float)
+//   kBeginTick
+//   kEndTick
+//   kSetDeferUpdates  enabled
+//   kProcessUpdates   units moved, max_delay
+//   kSetRangeTiers    count, bounds(float)...
+//   kSetLargeRange    range(float)
+
+struct TraceHeader {
+  char magic[4];
+  uint32_t version;
+  float width;
+  float height;
+  float visible_range;
+  uint32_t modes;  // Bits of the modes below
+};
+
+// Modes of the recorded AOI, which a replay sets before the first record
+const uint32_t kTracePairEvent = 1;
+const uint32_t kTraceDeferUpdates = 2;
+// Set by a kSetRangeTiers or kSetLargeRange record before any unit
+const uint32_t kTraceRangeTiers = 4;
+const uint32_t kTraceLargeRange = 8;
+
+const char kTraceMagic[4] = {'A', 'O', 'I', 'T'};
+const uint32_t kTraceVersion = 1;
+
+struct TraceRecord {
+  enum Op : uint8_t {
+    kAdd = 1,
+    kUpdate,
+    kRemove,
+    kQuery,
+    kBeginTick,
+    kEndTick,
+    kSetDeferUpdates,
+    kProcessUpdates,
+    kSetRangeTiers,
+    kSetLargeRange,
+  };
+
+  Op op;
+  AOI::UnitID id;
+  float x;
+  float y;
+  int flags;
+  float range;
+  uint32_t mask;
+  int layer;
+  bool enabled;
+  // The units moved by the recorded call, replays move as many
+  size_t max_units;
+  uint64_t max_delay;
+  std::vector<float> bounds;
+};
+
+// Record the operations on an AOI into a trace file while forwarding them
+class AOIRecorder {
+ public:
+  AOIRecorder(AOI* aoi, const char* path);
+  ~AOIRecorder();
+
+  AOIRecorder(const AOIRecorder&) = delete;
+  AOIRecorder(AOIRecorder&&) = delete;
+  AOIRecorder& operator=(const AOIRecorder&) = delete;
+  AOIRecorder& operator=(AOIRecorder&&) = delete;
+
+  bool IsOpen() const { return nullptr != fp_; }
+
+  // Modes must be set before any record, like on the AOI
+  void SetPairEvent(bool pair_event);
+  void SetRangeTiers(const std::vector<float>& bounds,
+                     AOI::TierCallback tier_callback);
+  void SetLargeRange(float range);
+
+  void AddUnit(AOI::UnitID id, float x, float y, int flags, float range,
+               uint32_t mask, int layer);
+  void AddUnit(AOI::UnitID id, float x, float y) {
+    AddUnit(id, x, y, AOI::kWatcher | AOI::kMarker,
+            aoi_->get_visible_range(), AOI::kAllMask, 0);
+  }
+  void UpdateUnit(AOI::UnitID id, float x, float y);
+  void RemoveUnit(AOI::UnitID id);
+  std::unordered_set<int> FindNearbyUnit(AOI::UnitID id, float range);
+  void BeginTick();
+  void EndTick();
+  void SetDeferUpdates(bool defer_updates);
+  size_t ProcessUpdates(const AOI::UpdateBudget& budget);
+
+  // Write buffered records to the file, records are also written when the
+  // buffer is full and at the end of every tick
+  void Flush();
+
+ private:
+  void SetMode(uint32_t mode, bool enabled);
+  void WriteRangeTiers(const std::vector<float>& bounds);
+  void WriteLargeRange(float range);
+  void WriteHeader();
+  void MaybeFlush();
+  void WriteVarint(uint64_t value);
+  void WriteInt(int64_t value);
+  void WriteFloat(float value);
+
+  AOI* const aoi_;
+  FILE* fp_;
+  TraceHeader header_;
+  std::vector<uint8_t> buffer_;
+  std::unordered_map<AOI::UnitID, std::pair<float, float>> positions_;
+};
+
+// Read a trace file through mmap
+class TraceReader {
+ public:
+  explicit TraceReader(const char* path);
+  ~TraceReader();
+
+  TraceReader(const TraceReader&) = delete;
+  TraceReader(TraceReader&&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+  TraceReader& operator=(TraceReader&&) = delete;
+
+  bool IsOpen() const { return nullptr != data_; }
+  const TraceHeader& header() const {
+    return *reinterpret_cast<const TraceHeader*>(data_);
+  }
+
+  // Decode next record, return false at the end of the trace or on a
+  // corrupted record
+  bool Next(TraceRecord* record);
+
+  // Restart from the first record
+  void Rewind();
+
+  // Whether all records have been decoded successfully
+  bool AtEnd() const { return pos_ >= size_ && !corrupted_; }
+
+ private:
+  bool Decode(TraceRecord* record);
+  bool ReadVarint(uint64_t* value);
+  bool ReadInt(int64_t* value);
+  bool ReadFloat(float* value);
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+  bool corrupted_;
+  std::unordered_map<AOI::UnitID, std::pair<float, float>> positions_;
+};
+
+#endif  // TRACE_H